@@ -31,10 +31,113 @@ extern "C" {
 #endif
 
 
+#include "hitime_hist.h"
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define HITIME_BINS (64)
+/* Build Options
+ * These may change the layout of the structs below so the library
+ * and its users must be compiled with the same values.
+ */
+
+/* Width of the times in bits, 64 or 32; there is one bin per bit. */
+#ifndef HITIME_TIME_BITS
+#define HITIME_TIME_BITS (64)
+#endif
+
+#if HITIME_TIME_BITS == 64
+typedef uint64_t hitime_time_t;
+#elif HITIME_TIME_BITS == 32
+typedef uint32_t hitime_time_t;
+#else
+#error "HITIME_TIME_BITS must be 64 or 32"
+#endif
+
+#define HITIME_BINS (HITIME_TIME_BITS)
+
+/* Track the earliest timeout of each bin for hitime_get_deadline. */
+#ifndef HITIME_EXACT_WAIT
+#define HITIME_EXACT_WAIT (0)
+#endif
+
+/* Let hitime_touch_lazy only store the time when pushing a timeout later;
+ * without it a lazy touch is a touch.
+ */
+#ifndef HITIME_LAZY_TOUCH
+#define HITIME_LAZY_TOUCH (0)
+#endif
+
+/* Apply the commands of a queue attached by hitime_set_cmdq at the top of
+ * every timeout; hitime_apply_cmdq works either way.
+ */
+#ifndef HITIME_CMDQ
+#define HITIME_CMDQ (0)
+#endif
+
+/* Store the bins as chunks of timeout pointers instead of linked lists. */
+#ifndef HITIME_CHUNKED_BINS
+#define HITIME_CHUNKED_BINS (0)
+#endif
+
+/* Timeouts per chunk; the default makes a chunk 256 octets. */
+#ifndef HITIME_CHUNK_LEN
+#define HITIME_CHUNK_LEN (28)
+#endif
+
+/* Keep timeouts due within 2**bits of the last time in a ring of as many
+ * slots, indexed by the time, so they expire without cascading.
+ * Zero leaves it out; otherwise from 4 to 12.
+ */
+#ifndef HITIME_NEAR_BITS
+#define HITIME_NEAR_BITS (0)
+#endif
+
+#if HITIME_NEAR_BITS && (HITIME_NEAR_BITS < 4 || HITIME_NEAR_BITS > 12)
+#error "HITIME_NEAR_BITS must be zero or from 4 to 12"
+#endif
+
+/* Count the timeouts of each bin and list as they move so counting is O(1).
+ * Adds a field to hitimeout_t; moving a whole bin visits each timeout.
+ */
+#ifndef HITIME_COUNTS
+#define HITIME_COUNTS (0)
+#endif
+
+/* Counters of the bins, then the ring, processing, and expired. */
+#define HITIME_COUNT_LISTS (HITIME_BINS + 3)
+
+/* Keep a hitime_stats_t in hitime_t of what the manager did; see hitime_get_stats.
+ * Without it hitime_t is unchanged and nothing is counted.
+ */
+#ifndef HITIME_STATS
+#define HITIME_STATS (0)
+#endif
+
+#define HITIME_STATS_LINE (64)
+
+/* Time each phase of hitime_timeout into a histogram; see hitime_get_phases.
+ * Times are TSC ticks on x86 and nanoseconds elsewhere.
+ */
+#ifndef HITIME_PHASES
+#define HITIME_PHASES (0)
+#endif
+
+/* Record how late each expired timeout is taken; see hitime_get_lateness. */
+#ifndef HITIME_LATENESS
+#define HITIME_LATENESS (0)
+#endif
+
+/* Record every call into a trace attached by hitime_set_trace. */
+#ifndef HITIME_TRACE
+#define HITIME_TRACE (0)
+#endif
+
+#if HITIME_NEAR_BITS
+#define HITIME_NEAR_SLOTS (1 << HITIME_NEAR_BITS)
+#define HITIME_NEAR_WORDS ((HITIME_NEAR_SLOTS + 63) / 64)
+#endif
 
 
 /* Node
@@ -46,16 +149,64 @@ typedef struct hitime_node_s
     struct hitime_node_s * prev;
 } hitime_node_t;
 
+#if HITIME_CHUNKED_BINS
+typedef struct hitime_chunk_s hitime_chunk_t;
+
+/* Reference
+ * Back-index of a timeout in a bin; the index is tagged with the low bit
+ * so it is never mistaken for a list node.
+ */
+typedef struct
+{
+    hitime_chunk_t * chunk;
+    uintptr_t        index;
+} hitime_ref_t;
+#endif
+
 /* Timeout
  * Embedable struct to track timeouts.
  */
 typedef struct
 {
+#if HITIME_CHUNKED_BINS
+    union
+    {
+        hitime_node_t node;//while expired
+        hitime_ref_t  ref;//while in a bin
+    };
+#else
     hitime_node_t node;
-    uint64_t      when;
+#endif
+    hitime_time_t when;
+#if HITIME_COUNTS
+    uint32_t      list;//counter of the list it is in, plus one; zero if none
+#endif
     void *        data;
 } hitimeout_t;
 
+#if HITIME_CHUNKED_BINS
+/* Bin
+ * Unrolled list of timeouts; only the last chunk is guaranteed to be full
+ * up to its length, so removal moves the last timeout into the hole.
+ */
+typedef struct hitime_bin_s
+{
+    hitime_chunk_t * head;
+    hitime_chunk_t * tail;
+} hitime_bin_t;
+
+struct hitime_chunk_s
+{
+    hitime_chunk_t * next;
+    hitime_chunk_t * prev;
+    hitime_bin_t *   bin;//bin the chunk belongs to
+    size_t           len;
+    hitimeout_t *    slots[HITIME_CHUNK_LEN];
+};
+#else
+typedef hitime_node_t hitime_bin_t;
+#endif
+
 void
 hitimeout_init(hitimeout_t *);
 void
@@ -63,54 +214,180 @@ hitimeout_reset(hitimeout_t *);
 void
 hitimeout_destroy(hitimeout_t *);
 void
-hitimeout_set(hitimeout_t *, uint64_t, void *);
-uint64_t
+hitimeout_set(hitimeout_t *, hitime_time_t, void *);
+hitime_time_t
 hitimeout_when(hitimeout_t *);
 void *
 hitimeout_data(hitimeout_t *);
 
+/* Stats
+ * Totals since the manager was initialized or the stats were reset.
+ */
+typedef struct
+{
+    uint64_t reinserted[HITIME_BINS + 1];//timeouts a cascade placed by bin; last is expired
+    uint64_t cascaded;//timeouts a cascade looked at
+    uint64_t max_cascade;//most timeouts cascaded by one call
+    uint64_t spliced;//timeouts expired with their whole bin or slot
+    uint64_t calls;//calls of hitime_timeout and hitime_timeout_partial
+    uint64_t empty_calls;//calls that expired nothing
+    uint64_t start_expired;//starts that went straight to expired
+    uint64_t touches;
+    uint64_t lazy_touches;//lazy touches that only stored the time
+} hitime_stats_t;
+
+/* Phases
+ * Of advancing the time, in order. The ring, if any, is expired with the
+ * first bin; the processing of hitime_timeout_partial counts as process all.
+ */
+enum
+{
+    HITIME_PHASE_EXPIRE_FIRST = 0,
+    HITIME_PHASE_EXPIRE_BULK,
+    HITIME_PHASE_PROCESS_SETUP,
+    HITIME_PHASE_PROCESS_ALL,
+    HITIME_PHASE_COUNT,
+};
+
+/* Command Queue
+ * See hitime_cmdq.h; optionally attached to the manager.
+ */
+typedef struct hitime_cmdq_s hitime_cmdq_t;
+
+/* Trace
+ * See hitime_trace.h; optionally attached to the manager.
+ */
+typedef struct hitime_trace_s hitime_trace_t;
+
 /* HiTime Timeout Manager
  * Stores timeouts until expiry.
  */
 typedef struct
 {
     /* Internal */
-    uint64_t      last;//last time given
+    hitime_time_t last;//last time given
+    uint64_t      bitset;//bins that have timeouts
+#if HITIME_LAZY_TOUCH
+    uint64_t      dirty;//bins that may have lazily touched timeouts
+#endif
+#if HITIME_CMDQ
+    hitime_cmdq_t *cmdq;//commands from other threads
+#endif
     hitime_node_t expired;
-    hitime_node_t processing;
-    hitime_node_t bins[HITIME_BINS];
+    hitime_bin_t  processing;
+    hitime_bin_t  bins[HITIME_BINS];
+#if HITIME_CHUNKED_BINS
+    hitime_chunk_t *spare;//empty chunks kept for reuse
+#endif
+#if HITIME_EXACT_WAIT
+    hitime_time_t mins[HITIME_BINS];//lower bound of each bin
+#endif
+#if HITIME_NEAR_BITS
+    uint64_t      near_words;//words of near_set that are non-zero
+    uint64_t      near_set[HITIME_NEAR_WORDS];//slots that have timeouts
+    hitime_bin_t  near[HITIME_NEAR_SLOTS];//slot of each time after last
+#endif
+#if HITIME_COUNTS
+    uint64_t      counts[HITIME_COUNT_LISTS];//timeouts in each bin and list
+#endif
+#if HITIME_STATS
+    _Alignas(HITIME_STATS_LINE)
+    hitime_stats_t stats;//kept off the lines of the fields above
+#endif
+#if HITIME_PHASES
+    int           phase_top;//highest bin triggered by the current call
+    int           phase_bins[HITIME_PHASE_COUNT];//highest bin triggered by the slowest call
+    hitime_hist_t phases[HITIME_PHASE_COUNT];//time spent in each phase
+#endif
+#if HITIME_LATENESS
+    hitime_hist_t lateness;//last time minus when of each expired timeout taken
+#endif
+#if HITIME_TRACE
+    hitime_trace_t *trace;//calls are recorded here when set
+#endif
 } hitime_t;
 
+/* Kernels
+ * Find the bins of timeouts in blocks when cascading; see hitime_set_kernel.
+ */
+enum
+{
+    HITIME_KERNEL_AUTO = 0,//fastest the CPU supports
+    HITIME_KERNEL_SCALAR,
+    HITIME_KERNEL_AVX2,
+    HITIME_KERNEL_AVX512,
+};
+
+/* Drain Callback
+ * Given each expired timeout and the context passed to hitime_drain.
+ */
+typedef void (*hitime_drain_cb)(hitimeout_t *, void *);
+
 
 void
 hitime_init(hitime_t *);
 void
 hitime_destroy(hitime_t *);
+void
+hitime_set_cmdq(hitime_t *, hitime_cmdq_t *);
+size_t
+hitime_apply_cmdq(hitime_t *, hitime_cmdq_t *);
+void
+hitime_set_trace(hitime_t *, hitime_trace_t *);
 
 void
 hitime_start(hitime_t *, hitimeout_t *);
 void
-hitime_start_range(hitime_t *, hitimeout_t *, uint64_t, uint64_t);
+hitime_start_range(hitime_t *, hitimeout_t *, hitime_time_t, hitime_time_t);
 void
 hitime_stop(hitime_t *, hitimeout_t *);
 void
-hitime_touch(hitime_t *, hitimeout_t *, uint64_t);
+hitime_start_many(hitime_t *, hitimeout_t **, size_t);
+void
+hitime_stop_many(hitime_t *, hitimeout_t **, size_t);
+void
+hitime_touch(hitime_t *, hitimeout_t *, hitime_time_t);
+void
+hitime_touch_lazy(hitime_t *, hitimeout_t *, hitime_time_t);
 
-uint64_t
+hitime_time_t
 hitime_get_wait(hitime_t *);
-uint64_t
-hitime_get_wait_with(hitime_t *, uint64_t);
+hitime_time_t
+hitime_get_wait_with(hitime_t *, hitime_time_t);
+hitime_time_t
+hitime_get_deadline(hitime_t *);
+hitime_time_t
+hitime_get_wait_exact(hitime_t *);
 bool
-hitime_timeout_elapse(hitime_t *, uint64_t);
+hitime_timeout_elapse(hitime_t *, hitime_time_t);
 bool
-hitime_timeout(hitime_t *, uint64_t);
+hitime_timeout(hitime_t *, hitime_time_t);
 bool
-hitime_timeout_partial(hitime_t *, uint64_t, int);
+hitime_timeout_partial(hitime_t *, hitime_time_t, int);
+
+void
+hitime_get_stats(hitime_t *, hitime_stats_t *);
+void
+hitime_reset_stats(hitime_t *);
+void
+hitime_get_phases(hitime_t *, hitime_summary_t *, int *);
+void
+hitime_reset_phases(hitime_t *);
+void
+hitime_get_lateness(hitime_t *, hitime_summary_t *);
+void
+hitime_reset_lateness(hitime_t *);
 
 void
 hitime_expire_all(hitime_t *);
 hitimeout_t *
 hitime_get_next(hitime_t *);
+int
+hitime_drain(hitime_t *, hitime_drain_cb, void *, int);
+void
+hitime_take_expired(hitime_t *, hitime_node_t *);
+hitimeout_t *
+hitime_list_next(hitime_node_t *);
 
 /* Convenience functions for allocations and time. */
 hitimeout_t *
@@ -123,6 +400,11 @@ hitime_new(void);
 void
 hitime_free(hitime_t * *);
 
+bool
+hitime_set_kernel(int);
+int
+hitime_get_kernel(void);
+
 uint64_t
 hitime_now_ms(void);
 
@@ -130,17 +412,17 @@ uint64_t
 hitime_now(void);
 
 /* Exports for testing. */
-uint64_t
+hitime_time_t
 hitime_max_wait(void);
-uint64_t
+hitime_time_t
 hitime_get_last(hitime_t *);
 void
 hitime_expire_bin(hitime_t *, int);
-int
+uint64_t
 hitime_count_bin(hitime_t *, int);
-int
+uint64_t
 hitime_count_all(hitime_t *);
-int
+uint64_t
 hitime_count_expired(hitime_t *);
 void
 hitime_dump_stats(hitime_t *);
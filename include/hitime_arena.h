@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_arena.h
+ * @author Craig Jacobson
+ * @brief Compact timeout manager for very many timeouts.
+ *
+ * Timeouts live in an arena owned by the manager and are named by index.
+ * Each node is 12 octets: 32-bit next/prev indices and a 32-bit time
+ * relative to the manager's epoch; there is no data pointer,
+ * the index is the handle to map back to your own records.
+ * Uses the same XOR-bin algorithm as hitime_t with 32 bins.
+ */
+#ifndef HITIME_ARENA_H_
+#define HITIME_ARENA_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define HITIME_ARENA_BINS (32)
+#define HITIME_ARENA_NIL (UINT32_MAX)
+
+/* Arena Node
+ * Links are indices into the arena; next is NIL when not in a list.
+ */
+typedef struct
+{
+    uint32_t next;
+    uint32_t prev;
+    uint32_t when;//relative to the epoch
+} hitime_anode_t;
+
+/* Arena Timeout Manager
+ * The first nodes of the arena are the list heads, timeouts follow.
+ */
+typedef struct
+{
+    uint64_t         epoch;//absolute time of relative zero
+    uint32_t         last;//last time given, relative to the epoch
+    uint32_t         bitset;//bins that have timeouts
+    uint32_t         free;//first unused timeout
+    uint32_t         len;//nodes in use or freed
+    uint32_t         cap;//nodes allocated
+    hitime_anode_t * nodes;
+} hitime_arena_t;
+
+
+void
+hitime_arena_init(hitime_arena_t *, uint32_t, uint64_t);
+void
+hitime_arena_destroy(hitime_arena_t *);
+hitime_arena_t *
+hitime_arena_new(uint32_t, uint64_t);
+void
+hitime_arena_free(hitime_arena_t **);
+
+uint32_t
+hitime_arena_alloc(hitime_arena_t *);
+void
+hitime_arena_release(hitime_arena_t *, uint32_t);
+
+bool
+hitime_arena_start(hitime_arena_t *, uint32_t, uint64_t);
+void
+hitime_arena_stop(hitime_arena_t *, uint32_t);
+uint64_t
+hitime_arena_when(hitime_arena_t *, uint32_t);
+
+uint64_t
+hitime_arena_get_wait(hitime_arena_t *);
+bool
+hitime_arena_timeout(hitime_arena_t *, uint64_t);
+void
+hitime_arena_expire_all(hitime_arena_t *);
+uint32_t
+hitime_arena_get_next(hitime_arena_t *);
+
+uint64_t
+hitime_arena_get_last(hitime_arena_t *);
+size_t
+hitime_arena_footprint(hitime_arena_t *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_ARENA_H_ */
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_cmdq.h
+ * @author Craig Jacobson
+ * @brief Lock-free command queue for starting and stopping from other threads.
+ *
+ * Any number of threads post start/stop/touch commands without blocking;
+ * the thread owning the hitime_t applies them with hitime_apply_cmdq,
+ * or at the top of hitime_timeout with HITIME_CMDQ.
+ */
+#ifndef HITIME_CMDQ_H_
+#define HITIME_CMDQ_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define HITIME_CACHE_LINE (64)
+
+
+enum
+{
+    HITIME_CMD_START = 1,
+    HITIME_CMD_STOP,
+    HITIME_CMD_TOUCH,
+};
+
+/* Slot
+ * The sequence tells producers and the consumer whose turn it is.
+ */
+typedef struct
+{
+    _Atomic uint64_t seq;
+    int              op;
+    hitimeout_t *    t;
+    hitime_time_t    when;
+} hitime_slot_t;
+
+/* Command Queue
+ * Bounded multi-producer, single-consumer ring.
+ */
+struct hitime_cmdq_s
+{
+    _Alignas(HITIME_CACHE_LINE)
+    _Atomic uint64_t tail;//producers
+    _Alignas(HITIME_CACHE_LINE)
+    _Atomic uint64_t head;//consumer
+    uint64_t         mask;
+    hitime_slot_t *  slots;
+};
+
+
+void
+hitime_cmdq_init(hitime_cmdq_t *, size_t);
+void
+hitime_cmdq_destroy(hitime_cmdq_t *);
+hitime_cmdq_t *
+hitime_cmdq_new(size_t);
+void
+hitime_cmdq_free(hitime_cmdq_t **);
+
+bool
+hitime_cmdq_start(hitime_cmdq_t *, hitimeout_t *, hitime_time_t);
+bool
+hitime_cmdq_stop(hitime_cmdq_t *, hitimeout_t *);
+bool
+hitime_cmdq_touch(hitime_cmdq_t *, hitimeout_t *, hitime_time_t);
+
+bool
+hitime_cmdq_pop(hitime_cmdq_t *, int *, hitimeout_t **, hitime_time_t *);
+size_t
+hitime_cmdq_size(hitime_cmdq_t *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_CMDQ_H_ */
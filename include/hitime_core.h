@@ -0,0 +1,325 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_core.h
+ * @author Craig Jacobson
+ * @brief Internal helpers shared by the library and hitime_inline.h.
+ *
+ * The list, bit, and bin bookkeeping behind start, stop, and touch.
+ * Not part of the API; include hitime.h or hitime_inline.h instead.
+ */
+#ifndef HITIME_CORE_H_
+#define HITIME_CORE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+#include "hitime_util.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * TIMEOUT FUNCTIONS
+*******************************************************************************/
+
+INLINE static hitime_node_t *
+to_node(hitimeout_t *t)
+{
+    return &t->node;
+}
+
+INLINE static hitimeout_t *
+to_timeout(hitime_node_t *n)
+{
+    return recover_ptr(n, hitimeout_t, node);
+}
+
+/*******************************************************************************
+ * NODE FUNCTIONS
+*******************************************************************************/
+
+INLINE static bool
+node_in_list(hitime_node_t *n)
+{
+    return !!n->next;
+}
+
+INLINE static void
+node_clear(hitime_node_t *n)
+{
+#if 0
+    n->next = NULL;
+    n->prev = NULL;
+#else
+    (*n) = (const hitime_node_t){ 0 };
+#endif
+}
+
+INLINE static void
+node_unlink_only(hitime_node_t *n)
+{
+    n->next->prev = n->prev;
+    n->prev->next = n->next;
+}
+
+INLINE static void
+node_unlink(hitime_node_t *n)
+{
+    node_unlink_only(n);
+    node_clear(n);
+}
+
+/*******************************************************************************
+ * LIST FUNCTIONS
+*******************************************************************************/
+
+INLINE static hitime_node_t *
+list_dq(hitime_node_t *l)
+{
+    hitime_node_t *n = NULL;
+
+    if (l != l->next)
+    {
+        n = l->next;
+        node_unlink(n);
+    }
+
+    return n;
+}
+
+INLINE static void
+list_nq(hitime_node_t *l, hitime_node_t *n)
+{
+    n->next = l;
+    n->prev = l->prev;
+    l->prev->next = n;
+    l->prev = n;
+}
+
+INLINE static bool
+list_is_empty(hitime_node_t *n)
+{
+    return (n == n->next);
+}
+
+INLINE static bool
+list_has(hitime_node_t *n)
+{
+    return (n != n->next);
+}
+
+INLINE static void
+list_clear(hitime_node_t *n)
+{
+    n->next = n;
+    n->prev = n;
+}
+
+INLINE static void
+lists_clear(hitime_node_t *l, size_t num)
+{
+    size_t i;
+    for (i = 0; i < num; ++i)
+    {
+        list_clear(l + i);
+    }
+}
+
+/**
+ * @brief Append items from l2 to l1.
+ */
+INLINE static void
+list_append(hitime_node_t *l1, hitime_node_t *l2)
+{
+    if (list_has(l2))
+    {
+        l2->next->prev = l1->prev;
+        l2->prev->next = l1;
+        l1->prev->next = l2->next;
+        l1->prev = l2->prev;
+        list_clear(l2);
+    }
+}
+
+INLINE static int
+list_count(hitime_node_t *l)
+{
+    int count = 0;
+    hitime_node_t *next = l->next;
+
+    while (next != l)
+    {
+        ++count;
+        next = next->next;
+    }
+
+    return count;
+}
+
+/*******************************************************************************
+ * BIN FUNCTIONS
+*******************************************************************************/
+
+INLINE static int
+is_expired(hitime_t *h, hitimeout_t *t)
+{
+    return (t->when <= h->last);
+}
+
+/**
+ * @brief Mark the bin as holding a timeout due at when.
+ */
+INLINE static void
+ht_mark_bin(hitime_t *h, int index, hitime_time_t when)
+{
+#if HITIME_EXACT_WAIT
+    /* Minimum is only valid while the bin is set; stop leaves it low. */
+    if (!(h->bitset & get_bit64(index)) || when < h->mins[index])
+    {
+        h->mins[index] = when;
+    }
+#else
+    (void)when;
+#endif
+    h->bitset |= get_bit64(index);
+}
+
+/**
+ * @return The bins that may have lazily touched timeouts.
+ */
+INLINE static uint64_t
+ht_get_dirty(hitime_t *h)
+{
+#if HITIME_LAZY_TOUCH
+    return h->dirty;
+#else
+    (void)h;
+    return 0;
+#endif
+}
+
+/**
+ * @brief Unmark the bins of the mask as having lazily touched timeouts.
+ */
+INLINE static void
+ht_clean_bins(hitime_t *h, uint64_t mask)
+{
+#if HITIME_LAZY_TOUCH
+    h->dirty &= ~mask;
+#else
+    (void)h;
+    (void)mask;
+#endif
+}
+
+#if HITIME_NEAR_BITS
+#define NEAR_MASK ((uint64_t)HITIME_NEAR_SLOTS - 1)
+
+/**
+ * @brief The ring spans the times after last up to one lap ahead,
+ *        so each slot holds exactly one of those times.
+ */
+INLINE static bool
+ht_is_near(hitime_t *h, hitimeout_t *t)
+{
+    return t->when - h->last <= (uint64_t)HITIME_NEAR_SLOTS;
+}
+
+/**
+ * @return The slot of the ring the near timeout belongs in.
+ */
+INLINE static int
+ht_near_slot(hitimeout_t *t)
+{
+    return (int)(t->when & NEAR_MASK);
+}
+
+INLINE static void
+ht_near_mark(hitime_t *h, int slot)
+{
+    h->near_set[slot >> 6] |= get_bit64(slot & 63);
+    h->near_words |= get_bit64(slot >> 6);
+}
+
+INLINE static void
+ht_near_clear(hitime_t *h, int slot)
+{
+    h->near_set[slot >> 6] &= ~get_bit64(slot & 63);
+    if (!h->near_set[slot >> 6])
+    {
+        h->near_words &= ~get_bit64(slot >> 6);
+    }
+}
+#endif
+
+/**
+ * @brief Clear the bit of the bin if it is one of the bins or slots.
+ */
+INLINE static void
+ht_clear_bin(hitime_t *h, hitime_bin_t *b)
+{
+    uintptr_t offset = (uintptr_t)b - (uintptr_t)h->bins;
+    if (offset < sizeof(h->bins))
+    {
+        uint64_t bit = get_bit64((int)(offset / sizeof(*b)));
+        h->bitset &= ~bit;
+        ht_clean_bins(h, bit);
+    }
+#if HITIME_NEAR_BITS
+    offset = (uintptr_t)b - (uintptr_t)h->near;
+    if (offset < sizeof(h->near))
+    {
+        ht_near_clear(h, (int)(offset / sizeof(*b)));
+    }
+#endif
+}
+
+#if !HITIME_CHUNKED_BINS
+/**
+ * @brief Unlink the node and clear the bin's bit if it was the last one.
+ *
+ * The previous node is a list head iff the list is now empty;
+ * only then do we need to know which list it was.
+ */
+INLINE static void
+ht_unlink_node(hitime_t *h, hitime_node_t *n)
+{
+    hitime_node_t *prev = n->prev;
+    node_unlink_only(n);
+
+    if (UNLIKELY(list_is_empty(prev)))
+    {
+        ht_clear_bin(h, prev);
+    }
+}
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_CORE_H_ */
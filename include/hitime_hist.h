@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_hist.h
+ * @author Craig Jacobson
+ * @brief Log-linear histogram of 64-bit values.
+ *
+ * Values below 2^HITIME_HIST_SUB_BITS have a bucket each; above that every
+ * power of two is split into 2^HITIME_HIST_SUB_BITS buckets, so a value is
+ * reported within an eighth of itself. Recording never allocates.
+ */
+#ifndef HITIME_HIST_H_
+#define HITIME_HIST_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdint.h>
+
+
+#define HITIME_HIST_SUB_BITS (3)
+#define HITIME_HIST_SUB (1 << HITIME_HIST_SUB_BITS)
+#define HITIME_HIST_BUCKETS ((64 - HITIME_HIST_SUB_BITS + 1) * HITIME_HIST_SUB)
+
+/* Histogram */
+typedef struct
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HITIME_HIST_BUCKETS];
+} hitime_hist_t;
+
+/* Summary
+ * Each percentile is the upper bound of its bucket, at most the max.
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} hitime_summary_t;
+
+/**
+ * @return The bucket of the value.
+ */
+static inline int
+hitime_hist_index(uint64_t v)
+{
+    if (v < HITIME_HIST_SUB)
+    {
+        return (int)v;
+    }
+
+#if defined __GNUC__
+    int high = 63 - __builtin_clzll(v);
+#else
+    int high = 0;
+    uint64_t n = v;
+    while (n >>= 1)
+    {
+        ++high;
+    }
+#endif
+    int shift = high - HITIME_HIST_SUB_BITS;
+    return ((shift + 1) << HITIME_HIST_SUB_BITS) | (int)((v >> shift) & (HITIME_HIST_SUB - 1));
+}
+
+static inline void
+hitime_hist_record(hitime_hist_t *hist, uint64_t v)
+{
+    ++hist->buckets[hitime_hist_index(v)];
+    ++hist->count;
+    if (v > hist->max)
+    {
+        hist->max = v;
+    }
+}
+
+void
+hitime_hist_reset(hitime_hist_t *);
+uint64_t
+hitime_hist_percentile(const hitime_hist_t *, double);
+void
+hitime_hist_summarize(const hitime_hist_t *, hitime_summary_t *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_HIST_H_ */
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_inline.h
+ * @author Craig Jacobson
+ * @brief Inline start, stop, and touch for hitime_t.
+ *
+ * Same as hitime_start, hitime_stop, and hitime_touch, but defined here so
+ * they are inlined into the caller without link-time optimization.
+ * Everything else, hitime_timeout included, stays in the library.
+ * Timeouts may be started inline and stopped by the library, or the reverse.
+ * With HITIME_CHUNKED_BINS these call the library since a bin may allocate,
+ * with HITIME_COUNTS or HITIME_STATS so the counters stay in one place,
+ * and with HITIME_TRACE so every call is recorded.
+ * The list and bin bookkeeping is the library's own, from hitime_core.h.
+ */
+#ifndef HITIME_INLINE_H_
+#define HITIME_INLINE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+#include "hitime_core.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#if !(HITIME_CHUNKED_BINS || HITIME_COUNTS || HITIME_STATS || HITIME_TRACE)
+/**
+ * @brief Add the timeout to its bin, or to expired if it has passed.
+ */
+static inline void
+hitime_inline_place(hitime_t *h, hitimeout_t *t)
+{
+    if (is_expired(h, t))
+    {
+        list_nq(&h->expired, to_node(t));
+        return;
+    }
+
+#if HITIME_NEAR_BITS
+    if (ht_is_near(h, t))
+    {
+        int slot = ht_near_slot(t);
+        list_nq(h->near + slot, to_node(t));
+        ht_near_mark(h, slot);
+        return;
+    }
+#endif
+
+    int index = get_high_index64(t->when ^ h->last);
+    list_nq(h->bins + index, to_node(t));
+    ht_mark_bin(h, index, t->when);
+}
+#endif
+
+/**
+ * @brief Same as hitime_start.
+ */
+static inline void
+hitime_start_inline(hitime_t *h, hitimeout_t *t)
+{
+#if HITIME_CHUNKED_BINS || HITIME_COUNTS || HITIME_STATS || HITIME_TRACE
+    hitime_start(h, t);
+#else
+    if (!node_in_list(to_node(t)))
+    {
+        hitime_inline_place(h, t);
+    }
+#endif
+}
+
+/**
+ * @brief Same as hitime_stop.
+ */
+static inline void
+hitime_stop_inline(hitime_t *h, hitimeout_t *t)
+{
+#if HITIME_CHUNKED_BINS || HITIME_COUNTS || HITIME_STATS || HITIME_TRACE
+    hitime_stop(h, t);
+#else
+    if (node_in_list(to_node(t)))
+    {
+        ht_unlink_node(h, to_node(t));
+        node_clear(to_node(t));
+    }
+#endif
+}
+
+/**
+ * @brief Same as hitime_touch.
+ */
+static inline void
+hitime_touch_inline(hitime_t *h, hitimeout_t *t, hitime_time_t when)
+{
+#if HITIME_CHUNKED_BINS || HITIME_COUNTS || HITIME_STATS || HITIME_TRACE
+    hitime_touch(h, t, when);
+#else
+    t->when = when;
+
+    if (node_in_list(to_node(t)))
+    {
+        ht_unlink_node(h, to_node(t));
+    }
+
+    hitime_inline_place(h, t);
+#endif
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_INLINE_H_ */
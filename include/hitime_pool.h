@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_pool.h
+ * @author Craig Jacobson
+ * @brief Slab allocator for hitimeout_t.
+ *
+ * Timeouts are carved out of large cache-aligned slabs so they sit next to
+ * each other in memory. Each thread keeps a small free list of its own and
+ * only takes the pool's lock to exchange a batch with the shared free list.
+ * That list goes back to the pool when the thread uses another pool or exits,
+ * or when it calls hitime_pool_flush_thread.
+ */
+#ifndef HITIME_POOL_H_
+#define HITIME_POOL_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+
+#include <stddef.h>
+
+/* Timeouts kept by each thread before half are handed back. */
+#ifndef HITIME_POOL_CACHE
+#define HITIME_POOL_CACHE (256)
+#endif
+
+/* Pool Flags */
+enum
+{
+    HITIME_POOL_HUGE = 1,//back slabs with huge pages when available
+};
+
+typedef struct hitime_pool_s hitime_pool_t;
+
+
+hitime_pool_t *
+hitime_pool_new(size_t, int);
+void
+hitime_pool_free(hitime_pool_t **);
+
+hitimeout_t *
+hitime_pool_alloc(hitime_pool_t *);
+void
+hitime_pool_release(hitime_pool_t *, hitimeout_t *);
+void
+hitime_pool_flush_thread(void);
+
+size_t
+hitime_pool_count_slabs(hitime_pool_t *);
+size_t
+hitime_pool_slab_size(hitime_pool_t *);
+
+void
+hitime_pool_set_default(hitime_pool_t *);
+hitime_pool_t *
+hitime_pool_get_default(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_POOL_H_ */
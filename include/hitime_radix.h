@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_radix.h
+ * @author Craig Jacobson
+ * @brief Timeout manager with a configurable radix.
+ *
+ * Same XOR principle as hitime_t, but the time is split into digits of
+ * k bits instead of single bits. Each level has 2**k slots, one per value
+ * of its digit, so a timeout moves at most HITIME_TIME_BITS/k times before it
+ * expires.
+ * With k = 1 this is the layout of hitime_t.
+ */
+#ifndef HITIME_RADIX_H_
+#define HITIME_RADIX_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest k; keeps the slots of a level in one 64-bit mask. */
+#define HITIME_RADIX_MAX_BITS (6)
+
+/* Radix Timeout Manager
+ * The slots are levels << bits list heads.
+ */
+typedef struct
+{
+    hitime_time_t   last;//last time given
+    uint64_t        levels_set;//levels that have timeouts
+    uint64_t        moves;//timeouts moved to a lower level
+    int             bits;//each level has 2**bits slots
+    int             levels;
+    uint64_t *      occupied;//slots that have timeouts, per level
+    hitime_node_t * slots;
+    hitime_node_t   expired;
+} hitime_radix_t;
+
+
+void
+hitime_radix_init(hitime_radix_t *, int);
+void
+hitime_radix_destroy(hitime_radix_t *);
+hitime_radix_t *
+hitime_radix_new(int);
+void
+hitime_radix_free(hitime_radix_t **);
+
+void
+hitime_radix_start(hitime_radix_t *, hitimeout_t *);
+void
+hitime_radix_stop(hitime_radix_t *, hitimeout_t *);
+void
+hitime_radix_touch(hitime_radix_t *, hitimeout_t *, hitime_time_t);
+
+hitime_time_t
+hitime_radix_get_wait(hitime_radix_t *);
+bool
+hitime_radix_timeout(hitime_radix_t *, hitime_time_t);
+void
+hitime_radix_expire_all(hitime_radix_t *);
+hitimeout_t *
+hitime_radix_get_next(hitime_radix_t *);
+
+hitime_time_t
+hitime_radix_get_last(hitime_radix_t *);
+uint64_t
+hitime_radix_get_moves(hitime_radix_t *);
+int
+hitime_radix_count_all(hitime_radix_t *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_RADIX_H_ */
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_sharded.h
+ * @author Craig Jacobson
+ * @brief Sharded timeout manager interface, one hitime_t per thread.
+ *
+ * Each shard is owned by one thread, which is the only thread that may
+ * touch the shard's hitime_t. Other threads post starts and stops to the
+ * shard's command queue; the owner applies them when timing out.
+ * A timeout remembers the shard it was started on, so stopping it reaches
+ * that shard from any thread.
+ */
+#ifndef HITIME_SHARDED_H_
+#define HITIME_SHARDED_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+#include "hitime_cmdq.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifndef HITIME_SHARD_QUEUE
+#define HITIME_SHARD_QUEUE (1024*16)
+#endif
+
+
+/* Shard Selection Policy */
+typedef enum
+{
+    HITIME_SHARD_THREAD,//shard bound to the calling thread
+    HITIME_SHARD_HASH,//shard chosen by the timeout's address
+} hitime_policy_t;
+
+/* Sharded Timeout
+ * A timeout and the shard it was last started or posted to.
+ * Zeroed it belongs to shard 0, which is harmless since stopping a timeout
+ * that is not started does nothing.
+ */
+typedef struct
+{
+    hitimeout_t t;
+    int         shard;
+} hitimeout_sharded_t;
+
+/* Shard
+ * Aligned so neighboring shards never share a cache line.
+ */
+typedef struct
+{
+    _Alignas(HITIME_CACHE_LINE)
+    hitime_t              ht;
+    _Atomic hitime_time_t deadline;//published by the owner
+    hitime_cmdq_t         cmdq;
+} hitime_shard_t;
+
+/* Sharded Timeout Manager */
+typedef struct
+{
+    int              count;
+    hitime_policy_t  policy;
+    hitime_shard_t * shards;
+} hitime_sharded_t;
+
+
+hitime_sharded_t *
+hitime_sharded_new(int, hitime_policy_t);
+void
+hitime_sharded_free(hitime_sharded_t **);
+
+int
+hitime_sharded_count(hitime_sharded_t *);
+void
+hitime_sharded_bind(hitime_sharded_t *, int);
+int
+hitime_sharded_bound(hitime_sharded_t *);
+int
+hitime_sharded_select(hitime_sharded_t *, hitimeout_sharded_t *);
+hitime_t *
+hitime_sharded_get(hitime_sharded_t *, int);
+
+bool
+hitime_sharded_start(hitime_sharded_t *, hitimeout_sharded_t *);
+bool
+hitime_sharded_stop(hitime_sharded_t *, hitimeout_sharded_t *);
+bool
+hitime_sharded_post_start(hitime_sharded_t *, int, hitimeout_sharded_t *);
+bool
+hitime_sharded_post_stop(hitime_sharded_t *, hitimeout_sharded_t *);
+
+bool
+hitime_sharded_timeout(hitime_sharded_t *, int, hitime_time_t);
+hitimeout_sharded_t *
+hitime_sharded_get_next(hitime_sharded_t *, int);
+hitime_time_t
+hitime_sharded_get_wait(hitime_sharded_t *, hitime_time_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_SHARDED_H_ */
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_trace.h
+ * @author Craig Jacobson
+ * @brief Binary trace of the calls made on a manager, for replay.
+ *
+ * Built with HITIME_TRACE, a manager given a trace with hitime_set_trace
+ * records every start, stop, touch, timeout, and expired timeout taken.
+ * A record is an op byte, the timeout's address as a varint delta from the
+ * last one, and the time as a varint relative to the manager's last time,
+ * so most records are a few octets. The timeouts are told apart by address,
+ * so the replay can map them onto timeouts of its own.
+ * Attaching the trace records the manager's last time as a base, so a trace
+ * may start on a manager that is already running. Timeouts already in the
+ * manager then are not recorded until they are next started, stopped,
+ * touched, or taken.
+ */
+#ifndef HITIME_TRACE_H_
+#define HITIME_TRACE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "hitime.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum
+{
+    HITIME_TRACE_START = 1,
+    HITIME_TRACE_STOP,
+    HITIME_TRACE_TOUCH,
+    HITIME_TRACE_TOUCH_LAZY,//only when the time was just stored
+    HITIME_TRACE_TIMEOUT,
+    HITIME_TRACE_PARTIAL,//arg is the max given
+    HITIME_TRACE_EXPIRE_ALL,
+    HITIME_TRACE_NEXT,//expired timeout taken by hitime_get_next or hitime_drain
+    HITIME_TRACE_TAKE,//hitime_take_expired
+    HITIME_TRACE_BASE,//last time of the manager when the trace was attached
+    HITIME_TRACE_OPS,
+};
+
+/* Record
+ * As read back; the time is absolute and the key is the timeout's address.
+ */
+typedef struct
+{
+    uint8_t       op;
+    uint64_t      key;
+    hitime_time_t time;
+    int64_t       arg;
+} hitime_trace_rec_t;
+
+
+hitime_trace_t *
+hitime_trace_open(const char *);
+void
+hitime_trace_close(hitime_trace_t **);
+void
+hitime_trace_record(hitime_trace_t *, int, const hitimeout_t *, hitime_time_t, hitime_time_t, int64_t);
+hitime_trace_rec_t *
+hitime_trace_read(const char *, size_t *);
+const char *
+hitime_trace_op_name(int);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* HITIME_TRACE_H_ */
@@ -31,12 +31,18 @@ extern "C" {
 #endif
 
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
 /// @cond DOXYGEN_IGNORE
 
 #define hitime_rawalloc _hitime_rawalloc_impl
+#define hitime_rawalloc_aligned _hitime_rawalloc_aligned_impl
 #define hitime_rawrealloc _hitime_rawrealloc_impl
 #define hitime_rawfree _hitime_rawfree_impl
 #define hitime_memzero(p, s) memset((p), 0, (s))
@@ -77,8 +83,197 @@ extern "C" {
 #   define UNUSED
 #endif
 
+#ifndef PREFETCH
+#   ifdef __GNUC__
+#       define PREFETCH(p) __builtin_prefetch((p), 1, 3)
+#   else
+#       define PREFETCH(p)
+#   endif
+#endif
+
+/* The struct holding the field p points to. */
+#ifndef recover_ptr
+#define recover_ptr(p, type, field) \
+    ((type *)((char *)(p) - offsetof(type, field)))
+#endif
+
 /// @endcond
 
+
+/*******************************************************************************
+ * BIT FUNCTIONS
+*******************************************************************************/
+
+#if !(defined __GNUC__)
+static const int8_t bits_to_log2[] =
+{
+    63, 0, 1, 52, 2, 6, 53, 26,
+    3, 37, 40, 7, 33, 54, 47, 27,
+    61, 4, 38, 45, 43, 41, 21, 8,
+    23, 34, 58, 55, 48, 17, 28, 10,
+    62, 51, 5, 25, 36, 39, 32, 46,
+    60, 44, 42, 20, 22, 57, 16, 9,
+    50, 24, 35, 31, 59, 19, 56, 15,
+    49, 30, 18, 14, 29, 13, 12, 11,
+};
+static const uint64_t bits_to_log2_multi = 0x022fdd63cc95386dULL;
+#endif
+
+/**
+ * @warn Do NOT input zero.
+ * @return The index of the highest set bit.
+ */
+INLINE static int
+get_high_index64(uint64_t n)
+{
+#if !(defined __GNUC__)
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;
+    n |= n >> 32;
+    n++;
+    return bits_to_log2[(n * bits_to_log2_multi) >> 58];
+#else
+    return 63 - __builtin_clzll(n);
+#endif
+}
+
+/**
+ * @warn Do NOT input zero.
+ * @return The index of the lowest set bit.
+ */
+INLINE static int
+get_low_index64(uint64_t n)
+{
+#if !(defined __GNUC__)
+    /* Table maps 2**x to x - 1, hence the adjustment. */
+    n &= -n;
+    return (bits_to_log2[(n * bits_to_log2_multi) >> 58] + 1) & 63;
+#else
+    return __builtin_ctzll(n);
+#endif
+}
+
+INLINE static uint64_t
+get_bit64(int index)
+{
+    return ((uint64_t)1) << index;
+}
+
+/**
+ * @warn Do NOT input zero.
+ * @return The index of the highest set bit.
+ */
+INLINE static int
+get_high_index32(uint32_t n)
+{
+#if !(defined __GNUC__)
+    int index = 0;
+    while (n >>= 1)
+    {
+        ++index;
+    }
+    return index;
+#else
+    return 31 - __builtin_clz(n);
+#endif
+}
+
+/**
+ * @warn Do NOT input zero.
+ * @return The index of the lowest set bit.
+ */
+INLINE static int
+get_low_index32(uint32_t n)
+{
+#if !(defined __GNUC__)
+    int index = 0;
+    while (!(n & 1))
+    {
+        n >>= 1;
+        ++index;
+    }
+    return index;
+#else
+    return __builtin_ctz(n);
+#endif
+}
+
+INLINE static uint32_t
+get_bit32(int index)
+{
+    return ((uint32_t)1) << index;
+}
+
+/*******************************************************************************
+ * ALLOC FUNCTIONS
+*******************************************************************************/
+
+static inline void
+_hitime_abort(bool is_malloc, size_t size)
+{
+    const char msg[] = "hitime %salloc(%zu) failure";
+
+    /* The 2 is for the prefix "re".
+     * Note that 2**64 is actually 20 max chars, good to have space.
+     */
+    char buf[sizeof(msg) + 2 + 32];
+
+    snprintf(buf, sizeof(buf), msg, is_malloc ? "m" : "re", size);
+    perror(buf);
+    abort();
+}
+
+INLINE static void *
+_hitime_rawalloc_impl(size_t size)
+{
+    void *mem = malloc(size);
+    if (UNLIKELY(!mem))
+    {
+        _hitime_abort(true, size);
+    }
+    return mem;
+}
+
+/**
+ * @param align - Power of two alignment.
+ * @param size - Rounded up to a multiple of the alignment.
+ */
+INLINE static void *
+_hitime_rawalloc_aligned_impl(size_t align, size_t size)
+{
+    size = (size + align - 1) & ~(align - 1);
+    void *mem = aligned_alloc(align, size);
+    if (UNLIKELY(!mem))
+    {
+        _hitime_abort(true, size);
+    }
+    return mem;
+}
+
+INLINE static void *
+_hitime_rawrealloc_impl(void *mem, size_t size)
+{
+    mem = realloc(mem, size);
+    if (UNLIKELY(!mem))
+    {
+        _hitime_abort(false, size);
+    }
+    return mem;
+}
+
+/*
+ * Don't check for NULL since hitime_free does operations
+ * that would cause segfault anyways.
+ */
+INLINE static void
+_hitime_rawfree_impl(void *mem)
+{
+    free(mem);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,14 +29,27 @@
  */
 
 #include "hitime.h"
+#include "hitime_cmdq.h"
+#include "hitime_core.h"
+#include "hitime_kernel.h"
+#include "hitime_pool.h"
+#include "hitime_trace.h"
 #include "hitime_util.h"
 
+#include <inttypes.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
+#if HITIME_PHASES && defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HITIME_TSC (1)
+#include <x86intrin.h>
+#else
+#define HITIME_TSC (0)
+#endif
 
 
 #if 0
@@ -95,13 +108,13 @@ hitimeout_destroy(hitimeout_t * t)
 }
 
 void
-hitimeout_set(hitimeout_t *t, uint64_t when, void *data)
+hitimeout_set(hitimeout_t *t, hitime_time_t when, void *data)
 {
     t->when = when;
     t->data = data;
 }
 
-uint64_t
+hitime_time_t
 hitimeout_when(hitimeout_t *t)
 {
     return t->when;
@@ -118,52 +131,31 @@ hitimeout_data(hitimeout_t *t)
  * HELPER FUNCTIONS
 *******************************************************************************/
 
-static const uint64_t WAITMAX = UINT64_MAX;
+static const hitime_time_t WAITMAX = (hitime_time_t)-1;
 
-INLINE static int
-is_expired(hitime_t *h, hitimeout_t *t)
-{
-    return (t->when <= h->last);
-}
+/* Timeouts handled per pass of hitime_start_many and of a cascade. */
+#ifndef HITIME_START_CHUNK
+#define HITIME_START_CHUNK (64)
+#endif
 
-#if !(defined __GNUC__)
-static const int8_t bits_to_log2[] =
-{
-    63, 0, 1, 52, 2, 6, 53, 26,
-    3, 37, 40, 7, 33, 54, 47, 27,
-    61, 4, 38, 45, 43, 41, 21, 8,
-    23, 34, 58, 55, 48, 17, 28, 10,
-    62, 51, 5, 25, 36, 39, 32, 46,
-    60, 44, 42, 20, 22, 57, 16, 9,
-    50, 24, 35, 31, 59, 19, 56, 15,
-    49, 30, 18, 14, 29, 13, 12, 11,
-};
-static const uint64_t bits_to_log2_multi = 0x022fdd63cc95386dULL;
+/* How many timeouts ahead to prefetch in the batch functions. */
+#ifndef HITIME_PREFETCH_AHEAD
+#define HITIME_PREFETCH_AHEAD (8)
 #endif
 
 /**
- * @warn Do NOT input zero.
- * @return The index of the highest set bit.
+ * @return Mask of the bits in the range [low, high).
  */
-INLINE static int
-get_high_index64(uint64_t n)
-{
-#if !(defined __GNUC__)
-    n |= n >> 1;
-    n |= n >> 2;
-    n |= n >> 4;
-    n |= n >> 8;
-    n |= n >> 16;
-    n |= n >> 32;
-    n++;
-    return bits_to_log2[(n * bits_to_log2_multi) >> 58];
-#else
-    return 63 - __builtin_clzl(n);
-#endif
+INLINE static uint64_t
+get_range64(int low, int high)
+{
+    uint64_t hmask = high >= 64 ? UINT64_MAX : get_bit64(high) - 1;
+    uint64_t lmask = get_bit64(low) - 1;
+    return hmask & ~lmask;
 }
 
-INLINE static uint64_t
-get_elpased(uint64_t now, uint64_t last)
+INLINE static hitime_time_t
+get_elpased(hitime_time_t now, hitime_time_t last)
 {
     return now - last;
 }
@@ -174,454 +166,1911 @@ ht_get_expired(hitime_t *h)
     return &h->expired;
 }
 
-INLINE static hitime_node_t *
+INLINE static hitime_bin_t *
 ht_get_processing(hitime_t *h)
 {
     return &h->processing;
 }
 
 /*******************************************************************************
- * TIMEOUT FUNCTIONS
+ * COUNT FUNCTIONS
 *******************************************************************************/
 
-#ifndef recover_ptr
-#define recover_ptr(p, type, field) \
-    ((type *)((char *)(p) - offsetof(type, field)))
-#endif
+#define COUNT_NEAR (HITIME_BINS)
+#define COUNT_PROCESSING (HITIME_BINS + 1)
+#define COUNT_EXPIRED (HITIME_BINS + 2)
 
-INLINE static hitime_node_t *
-to_node(hitimeout_t *t)
+/**
+ * @brief Move the timeout from the counter of its list, if any, to the given one.
+ */
+INLINE static void
+ht_count_set(hitime_t *h, hitimeout_t *t, int list)
 {
-    return &t->node;
+#if HITIME_COUNTS
+    if (t->list)
+    {
+        --h->counts[t->list - 1];
+    }
+    ++h->counts[list];
+    t->list = (uint32_t)list + 1;
+#else
+    (void)h;
+    (void)t;
+    (void)list;
+#endif
 }
 
-INLINE static hitimeout_t *
-to_timeout(hitime_node_t *n)
+/**
+ * @brief Take the timeout off the counter of its list, if any.
+ */
+INLINE static void
+ht_count_clear(hitime_t *h, hitimeout_t *t)
 {
-    return recover_ptr(n, hitimeout_t, node);
+#if HITIME_COUNTS
+    if (t->list)
+    {
+        --h->counts[t->list - 1];
+        t->list = 0;
+    }
+#else
+    (void)h;
+    (void)t;
+#endif
 }
 
-/*******************************************************************************
- * NODE FUNCTIONS
-*******************************************************************************/
+/**
+ * @brief Same as ht_count_set for every timeout of the list;
+ *        negative takes them off their counters instead.
+ */
+INLINE static void
+ht_count_list(hitime_t *h, hitime_node_t *l, int list)
+{
+#if HITIME_COUNTS
+    hitime_node_t *n;
+    for (n = l->next; n != l; n = n->next)
+    {
+        if (list < 0)
+        {
+            ht_count_clear(h, to_timeout(n));
+        }
+        else
+        {
+            ht_count_set(h, to_timeout(n), list);
+        }
+    }
+#else
+    (void)h;
+    (void)l;
+    (void)list;
+#endif
+}
 
-INLINE static bool
-node_in_list(hitime_node_t *n)
+/**
+ * @brief Add the timeout to the end of the expired list.
+ */
+INLINE static void
+ht_expire_one(hitime_t *h, hitimeout_t *t)
 {
-    return !!n->next;
+    list_nq(ht_get_expired(h), to_node(t));
+    ht_count_set(h, t, COUNT_EXPIRED);
 }
 
+/*******************************************************************************
+ * STATS FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @brief Record the bins found for a block of cascaded timeouts.
+ */
 INLINE static void
-node_clear(hitime_node_t *n)
+ht_stat_cascade(hitime_t *h, const uint8_t *index, size_t n)
 {
-#if 0
-    n->next = NULL;
-    n->prev = NULL;
+#if HITIME_STATS
+    size_t i;
+    for (i = 0; i < n; ++i)
+    {
+        ++h->stats.reinserted[index[i]];
+    }
+    h->stats.cascaded += n;
 #else
-    (*n) = (const hitime_node_t){ 0 };
+    (void)h;
+    (void)index;
+    (void)n;
 #endif
 }
 
+#if HITIME_STATS
+/* What a timeout call is measured against. */
+typedef struct
+{
+    hitime_node_t * tail;//last expired before the call
+    uint64_t        cascaded;
+} ht_mark_t;
+
 INLINE static void
-node_unlink_only(hitime_node_t *n)
+ht_stat_begin(hitime_t *h, ht_mark_t *m)
 {
-    n->next->prev = n->prev;
-    n->prev->next = n->next;
+    m->tail = ht_get_expired(h)->prev;
+    m->cascaded = h->stats.cascaded;
 }
 
+/**
+ * @brief Nothing expired by the call if the expired list has the same last.
+ *        The caller may not take expired timeouts in between.
+ */
 INLINE static void
-node_unlink(hitime_node_t *n)
+ht_stat_end(hitime_t *h, const ht_mark_t *m)
 {
-    node_unlink_only(n);
-    node_clear(n);
+    uint64_t cascaded = h->stats.cascaded - m->cascaded;
+    if (cascaded > h->stats.max_cascade)
+    {
+        h->stats.max_cascade = cascaded;
+    }
+    ++h->stats.calls;
+    h->stats.empty_calls += ht_get_expired(h)->prev == m->tail;
 }
+#endif
 
 /*******************************************************************************
- * LIST FUNCTIONS
+ * PHASE FUNCTIONS
 *******************************************************************************/
 
-INLINE static hitime_node_t *
-list_dq(hitime_node_t *l)
+/**
+ * @return Ticks for timing the phases; zero without HITIME_PHASES.
+ */
+INLINE static uint64_t
+ht_ticks(void)
 {
-    hitime_node_t *n = NULL;
+#if HITIME_PHASES && HITIME_TSC
+    return __rdtsc();
+#elif HITIME_PHASES
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
 
-    if (l != l->next)
+/**
+ * @brief Record the time since the tick into the phase and restart the tick.
+ *        The slowest of each phase keeps the highest bin of its call.
+ */
+INLINE static void
+ht_phase_lap(hitime_t *h, int phase, uint64_t *tick)
+{
+#if HITIME_PHASES
+    uint64_t now = ht_ticks();
+    uint64_t elapsed = now - *tick;
+    if (elapsed > h->phases[phase].max || !h->phases[phase].count)
     {
-        n = l->next;
-        node_unlink(n);
+        h->phase_bins[phase] = h->phase_top;
     }
+    hitime_hist_record(h->phases + phase, elapsed);
+    *tick = now;
+#else
+    (void)h;
+    (void)phase;
+    (void)tick;
+#endif
+}
 
-    return n;
+/**
+ * @brief Record how long ago the timeout was due as it is taken.
+ *        Timeouts taken early by hitime_expire_all count as on time.
+ */
+INLINE static void
+ht_late(hitime_t *h, hitimeout_t *t)
+{
+#if HITIME_LATENESS
+    hitime_time_t late = h->last > t->when ? h->last - t->when : 0;
+    hitime_hist_record(&h->lateness, (uint64_t)late);
+#else
+    (void)h;
+    (void)t;
+#endif
 }
 
+/*******************************************************************************
+ * TRACE FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @brief Record the call if a trace is attached.
+ */
 INLINE static void
-list_nq(hitime_node_t *l, hitime_node_t *n)
+ht_trace(hitime_t *h, int op, hitimeout_t *t, hitime_time_t time, int64_t arg)
 {
-    n->next = l;
-    n->prev = l->prev;
-    l->prev->next = n;
-    l->prev = n;
+#if HITIME_TRACE
+    if (UNLIKELY(h->trace))
+    {
+        hitime_trace_record(h->trace, op, t, time, h->last, arg);
+    }
+#else
+    (void)h;
+    (void)op;
+    (void)t;
+    (void)time;
+    (void)arg;
+#endif
 }
 
+/*******************************************************************************
+ * BIN FUNCTIONS
+*******************************************************************************/
+
+#if HITIME_CHUNKED_BINS
+
+#define CHUNK_ALIGN (64)
+
+/**
+ * @return True if the timeout is in a bin rather than a list.
+ */
 INLINE static bool
-list_is_empty(hitime_node_t *n)
+slot_in_chunk(hitimeout_t *t)
 {
-    return (n == n->next);
+    return t->ref.index & 1;
 }
 
-INLINE static bool
-list_has(hitime_node_t *n)
+INLINE static void
+slot_set(hitimeout_t *t, hitime_chunk_t *c, size_t index)
+{
+    t->ref.chunk = c;
+    t->ref.index = (index << 1) | 1;
+}
+
+INLINE static size_t
+slot_get_index(hitimeout_t *t)
 {
-    return (n != n->next);
+    return t->ref.index >> 1;
 }
 
 INLINE static void
-list_clear(hitime_node_t *n)
+bin_clear(hitime_bin_t *b)
 {
-    n->next = n;
-    n->prev = n;
+    b->head = NULL;
+    b->tail = NULL;
 }
 
 INLINE static void
-lists_clear(hitime_node_t *l, size_t num)
+bins_clear(hitime_bin_t *b, size_t num)
 {
     size_t i;
     for (i = 0; i < num; ++i)
     {
-        list_clear(l + i);
+        bin_clear(b + i);
     }
 }
 
-/**
- * @brief Append items from l2 to l1.
- */
-INLINE static void
-list_append(hitime_node_t *l1, hitime_node_t *l2)
+INLINE static bool
+bin_has(hitime_bin_t *b)
 {
-    if (list_has(l2))
-    {
-        l2->next->prev = l1->prev;
-        l2->prev->next = l1;
-        l1->prev->next = l2->next;
-        l1->prev = l2->prev;
-        list_clear(l2);
-    }
+    return !!b->head;
 }
 
 INLINE static int
-list_count(hitime_node_t *l)
+bin_count(hitime_bin_t *b)
 {
     int count = 0;
-    hitime_node_t *next = l->next;
+    hitime_chunk_t *c;
 
-    while (next != l)
+    for (c = b->head; c; c = c->next)
     {
-        ++count;
-        next = next->next;
+        count += (int)c->len;
     }
 
     return count;
 }
 
-/*******************************************************************************
- * HIGHTIME FUNCTIONS
-*******************************************************************************/
+INLINE static void
+ht_chunk_release(hitime_t *h, hitime_chunk_t *c)
+{
+    c->next = h->spare;
+    h->spare = c;
+}
+
+static void
+ht_chunks_free(hitime_chunk_t *c)
+{
+    while (c)
+    {
+        hitime_chunk_t *next = c->next;
+        hitime_rawfree(c);
+        c = next;
+    }
+}
+
+/**
+ * @brief Add an empty chunk to the end of the bin, reusing a spare if any.
+ */
+NOINLINE static hitime_chunk_t *
+ht_chunk_push(hitime_t *h, hitime_bin_t *b)
+{
+    hitime_chunk_t *c = h->spare;
+    if (c)
+    {
+        h->spare = c->next;
+    }
+    else
+    {
+        c = hitime_rawalloc_aligned(CHUNK_ALIGN, sizeof(hitime_chunk_t));
+    }
+
+    c->next = NULL;
+    c->prev = b->tail;
+    c->bin = b;
+    c->len = 0;
+    if (b->tail)
+    {
+        b->tail->next = c;
+    }
+    else
+    {
+        b->head = c;
+    }
+    b->tail = c;
+
+    return c;
+}
 
 INLINE static void
-ht_nq(hitime_t *h, hitimeout_t *t)
+ht_bin_nq(hitime_t *h, hitime_bin_t *b, hitimeout_t *t)
 {
-    /* Find which list to add the hitimeout to. */
-    uint64_t bits = t->when ^ h->last;
-    int index = get_high_index64(bits);
-    list_nq(&h->bins[index], to_node(t));
+    hitime_chunk_t *c = b->tail;
+    if (UNLIKELY(!c || HITIME_CHUNK_LEN == c->len))
+    {
+        c = ht_chunk_push(h, b);
+    }
+
+    slot_set(t, c, c->len);
+    c->slots[c->len++] = t;
 }
 
 /**
- * @brief Initialize embedded struct.
+ * @brief Remove the timeout by moving the last timeout of its bin into its slot.
+ * @return The bin if it is now empty; NULL otherwise.
  */
-void
-hitime_init(hitime_t *h)
+INLINE static hitime_bin_t *
+ht_bin_remove(hitime_t *h, hitimeout_t *t)
 {
-    h->last = 0;
-    list_clear(&h->expired);
-    list_clear(&h->processing);
-    lists_clear(h->bins, HITIME_BINS);
+    hitime_chunk_t *c = t->ref.chunk;
+    hitime_bin_t *b = c->bin;
+    hitime_chunk_t *tail = b->tail;
+
+    hitimeout_t *last = tail->slots[--tail->len];
+    if (last != t)
+    {
+        size_t index = slot_get_index(t);
+        c->slots[index] = last;
+        slot_set(last, c, index);
+    }
+
+    if (!tail->len)
+    {
+        b->tail = tail->prev;
+        if (b->tail)
+        {
+            b->tail->next = NULL;
+        }
+        else
+        {
+            b->head = NULL;
+        }
+        ht_chunk_release(h, tail);
+    }
+
+    return b->head ? NULL : b;
 }
 
 /**
- * @brief Cleanup embedded struct that was previously initialized.
- * @warn You must cleanup all hitimeouts before calling this;
- *       recommended to first handle expired hitimeouts,
- *       second call hitime_expire_all and handle remaining expired hitimeouts.
+ * @brief Link the timeouts of the bin onto the end of the expired list.
  */
-void
-hitime_destroy(hitime_t *h)
+INLINE static void
+ht_bin_expire(hitime_t *h, hitime_bin_t *b)
 {
-    (*h) = (const hitime_t){ 0 };
+    hitime_node_t *l = ht_get_expired(h);
+    hitime_chunk_t *c = b->head;
+
+    while (c)
+    {
+        hitime_chunk_t *next = c->next;
+        size_t i;
+        for (i = 0; i < c->len; ++i)
+        {
+            if (i + HITIME_PREFETCH_AHEAD < c->len)
+            {
+                PREFETCH(c->slots[i + HITIME_PREFETCH_AHEAD]);
+            }
+            list_nq(l, to_node(c->slots[i]));
+            ht_count_set(h, c->slots[i], COUNT_EXPIRED);
+        }
+        ht_chunk_release(h, c);
+        c = next;
+    }
+
+    bin_clear(b);
 }
 
 /**
- * @brief Add the hitimeout to the manager.
- * @warn Remember to maintain referential stability! 'hitimeout_t' is a node internally!
- * @param h
- * @param t - The hitimeout to add.
- *
- * If the hitimeout appears to be a part of a list already, do nothing.
- * If the hitimeout has already expired then added to expired list.
- * Otherwise, the hitimeout to the internal data structure for future processing.
+ * @brief Move the chunks of the bin onto the end of the processing bin.
  */
-void
-hitime_start(hitime_t * h, hitimeout_t *t)
+INLINE static void
+ht_bin_defer(hitime_t *h, hitime_bin_t *b)
 {
-    /* Timeouts should not be in a list already. */
-    if (UNLIKELY(node_in_list(to_node(t))))
+    hitime_bin_t *p = ht_get_processing(h);
+    hitime_chunk_t *c;
+
+    for (c = b->head; c; c = c->next)
     {
-        return;
+        c->bin = p;
+#if HITIME_COUNTS
+        size_t i;
+        for (i = 0; i < c->len; ++i)
+        {
+            ht_count_set(h, c->slots[i], COUNT_PROCESSING);
+        }
+#endif
     }
 
-    /* If this already expired, then add to expired.
-     * Ensures delta in next step is non-zero.
-     */
-    if (UNLIKELY(is_expired(h, t)))
+    if (p->tail)
     {
-        list_nq(ht_get_expired(h), to_node(t));
+        p->tail->next = b->head;
+        b->head->prev = p->tail;
     }
     else
     {
-        ht_nq(h, t);
+        p->head = b->head;
     }
+    p->tail = b->tail;
+
+    bin_clear(b);
 }
 
 /**
- * Set the timeout to be between the two values.
- * The objective is to minimize the number of times the
- * timeout gets handled internally.
- * @param h
- * @param t - Timeout to update.
- * @param min - The minimum expired time.
- * @param max - The maximum expired time.
+ * @brief Move the timeouts of the non-empty bin to expired or processing.
  */
-void
-hitime_start_range(hitime_t *h, hitimeout_t *t, uint64_t min, uint64_t max)
+INLINE static void
+ht_bin_move(hitime_t *h, hitime_bin_t *b, bool expire)
 {
-    uint64_t newwhen;
-    uint64_t bits = max ^ min;
+#if HITIME_STATS
+    if (expire)
+    {
+        h->stats.spliced += (uint64_t)bin_count(b);
+    }
+#endif
+    if (expire)
+    {
+        ht_bin_expire(h, b);
+    }
+    else
+    {
+        ht_bin_defer(h, b);
+    }
+}
 
-    if (LIKELY(bits))
+#else
+
+INLINE static void
+bin_clear(hitime_bin_t *b)
+{
+    list_clear(b);
+}
+
+INLINE static void
+bins_clear(hitime_bin_t *b, size_t num)
+{
+    lists_clear(b, num);
+}
+
+INLINE static bool
+bin_has(hitime_bin_t *b)
+{
+    return list_has(b);
+}
+
+INLINE static int
+bin_count(hitime_bin_t *b)
+{
+    return list_count(b);
+}
+
+INLINE static void
+ht_bin_nq(hitime_t *h, hitime_bin_t *b, hitimeout_t *t)
+{
+    (void)h;
+    list_nq(b, to_node(t));
+}
+
+/**
+ * @brief Move the timeouts of the bin to expired or processing.
+ */
+INLINE static void
+ht_bin_move(hitime_t *h, hitime_bin_t *b, bool expire)
+{
+#if HITIME_STATS
+    if (expire)
+    {
+        h->stats.spliced += (uint64_t)bin_count(b);
+    }
+#endif
+    ht_count_list(h, b, expire ? COUNT_EXPIRED : COUNT_PROCESSING);
+    list_append(expire ? ht_get_expired(h) : ht_get_processing(h), b);
+}
+
+#endif
+
+/*******************************************************************************
+ * NEAR FUNCTIONS
+*******************************************************************************/
+
+#if HITIME_NEAR_BITS
+INLINE static void
+ht_near_nq(hitime_t *h, hitimeout_t *t)
+{
+    int slot = ht_near_slot(t);
+    ht_bin_nq(h, h->near + slot, t);
+    ht_count_set(h, t, COUNT_NEAR);
+    ht_near_mark(h, slot);
+}
+
+/**
+ * @brief Find the first slot with timeouts at or after from, wrapping around.
+ * @return The slot; negative if the ring is empty.
+ */
+INLINE static int
+ht_near_find(hitime_t *h, int from)
+{
+    int w = from >> 6;
+    uint64_t bits = h->near_set[w] & ~(get_bit64(from & 63) - 1);
+    if (bits)
+    {
+        return (w << 6) | get_low_index64(bits);
+    }
+
+    /* Later words first, then wrap around; the word itself has only lower slots. */
+    uint64_t words = h->near_words & ~(get_bit64(w) - 1) & ~get_bit64(w);
+    if (!words)
+    {
+        words = h->near_words;
+    }
+    if (!words)
+    {
+        return -1;
+    }
+
+    w = get_low_index64(words);
+    return (w << 6) | get_low_index64(h->near_set[w]);
+}
+
+/**
+ * @return Time after last of the first timeout in the ring; max wait if none.
+ */
+INLINE static hitime_time_t
+ht_near_wait(hitime_t *h)
+{
+    if (!h->near_words)
+    {
+        return WAITMAX;
+    }
+
+    int slot = ht_near_find(h, (int)((h->last + 1) & NEAR_MASK));
+    return (((uint64_t)slot - h->last - 1) & NEAR_MASK) + 1;
+}
+
+/**
+ * @brief Expire the slots of the times after last, in order.
+ * @param elapsed - The number of times to expire; a lap or more is all.
+ *
+ * A slot holds only timeouts of the one time it stands for,
+ * so the whole slot is expired.
+ */
+INLINE static void
+ht_near_expire(hitime_t *h, hitime_time_t elapsed)
+{
+    int from = (int)((h->last + 1) & NEAR_MASK);
+    int slot;
+
+    while (h->near_words)
+    {
+        slot = ht_near_find(h, from);
+        if (((uint64_t)(slot - from) & NEAR_MASK) >= elapsed)
+        {
+            break;
+        }
+        ht_near_clear(h, slot);
+        ht_bin_move(h, h->near + slot, true);
+    }
+}
+#endif
+
+/*******************************************************************************
+ * HIGHTIME FUNCTIONS
+*******************************************************************************/
+
+INLINE static void
+ht_nq_at(hitime_t *h, hitimeout_t *t, int index)
+{
+    ht_bin_nq(h, h->bins + index, t);
+    ht_count_set(h, t, index);
+    ht_mark_bin(h, index, t->when);
+}
+
+/**
+ * @brief Same as ht_nq_at, except near timeouts go to the ring.
+ */
+INLINE static void
+ht_nq_found(hitime_t *h, hitimeout_t *t, int index)
+{
+#if HITIME_NEAR_BITS
+    if (ht_is_near(h, t))
+    {
+        ht_near_nq(h, t);
+        return;
+    }
+#endif
+    ht_nq_at(h, t, index);
+}
+
+INLINE static void
+ht_nq(hitime_t *h, hitimeout_t *t)
+{
+    /* Find which bin to add the hitimeout to. */
+    hitime_time_t bits = t->when ^ h->last;
+    ht_nq_found(h, t, get_high_index64(bits));
+}
+
+/**
+ * @brief Move the contents of the bin to the expired list if expire,
+ *        the processing list otherwise.
+ */
+INLINE static void
+ht_take_bin(hitime_t *h, int index, bool expire)
+{
+    if (h->bitset & get_bit64(index))
+    {
+        ht_bin_move(h, h->bins + index, expire);
+    }
+    h->bitset &= ~get_bit64(index);
+    ht_clean_bins(h, get_bit64(index));
+}
+
+/**
+ * @brief Same as ht_take_bin for every bin in the mask.
+ *        Empty bins are skipped entirely.
+ */
+INLINE static void
+ht_take_bins(hitime_t *h, uint64_t mask, bool expire)
+{
+    uint64_t bits = mask & h->bitset;
+    h->bitset &= ~mask;
+    ht_clean_bins(h, mask);
+
+    while (bits)
+    {
+        int index = get_low_index64(bits);
+        ht_bin_move(h, h->bins + index, expire);
+        bits &= bits - 1;
+    }
+}
+
+#if HITIME_CHUNKED_BINS
+/**
+ * @brief Remove the timeout and clear the bin's bit if it was the last one.
+ */
+INLINE static void
+ht_unlink_only(hitime_t *h, hitimeout_t *t)
+{
+    ht_count_clear(h, t);
+    if (UNLIKELY(!slot_in_chunk(t)))
+    {
+        node_unlink_only(to_node(t));
+        return;
+    }
+
+    hitime_bin_t *b = ht_bin_remove(h, t);
+    if (UNLIKELY(b))
+    {
+        ht_clear_bin(h, b);
+    }
+}
+#else
+/**
+ * @brief Unlink the timeout and clear the bin's bit if it was the last one.
+ */
+INLINE static void
+ht_unlink_only(hitime_t *h, hitimeout_t *t)
+{
+    ht_count_clear(h, t);
+    ht_unlink_node(h, to_node(t));
+}
+#endif
+
+/**
+ * @brief Initialize embedded struct.
+ */
+void
+hitime_init(hitime_t *h)
+{
+    h->last = 0;
+    h->bitset = 0;
+#if HITIME_LAZY_TOUCH
+    h->dirty = 0;
+#endif
+#if HITIME_CMDQ
+    h->cmdq = NULL;
+#endif
+#if HITIME_TRACE
+    h->trace = NULL;
+#endif
+    list_clear(&h->expired);
+    bin_clear(&h->processing);
+    bins_clear(h->bins, HITIME_BINS);
+#if HITIME_CHUNKED_BINS
+    h->spare = NULL;
+#endif
+#if HITIME_NEAR_BITS
+    h->near_words = 0;
+    memset(h->near_set, 0, sizeof(h->near_set));
+    bins_clear(h->near, HITIME_NEAR_SLOTS);
+#endif
+#if HITIME_COUNTS
+    memset(h->counts, 0, sizeof(h->counts));
+#endif
+#if HITIME_STATS
+    memset(&h->stats, 0, sizeof(h->stats));
+#endif
+#if HITIME_PHASES
+    hitime_reset_phases(h);
+#endif
+#if HITIME_LATENESS
+    hitime_reset_lateness(h);
+#endif
+}
+
+/**
+ * @brief Cleanup embedded struct that was previously initialized.
+ *        With HITIME_CHUNKED_BINS this frees the chunks of the bins.
+ * @warn You must cleanup all hitimeouts before calling this;
+ *       recommended to first handle expired hitimeouts,
+ *       second call hitime_expire_all and handle remaining expired hitimeouts.
+ */
+void
+hitime_destroy(hitime_t *h)
+{
+#if HITIME_CHUNKED_BINS
+    int i;
+    for (i = 0; i < HITIME_BINS; ++i)
+    {
+        ht_chunks_free(h->bins[i].head);
+    }
+#if HITIME_NEAR_BITS
+    for (i = 0; i < HITIME_NEAR_SLOTS; ++i)
+    {
+        ht_chunks_free(h->near[i].head);
+    }
+#endif
+    ht_chunks_free(h->processing.head);
+    ht_chunks_free(h->spare);
+#endif
+    (*h) = (const hitime_t){ 0 };
+}
+
+/**
+ * @brief Attach a command queue, applied at the top of every timeout.
+ * @param h
+ * @param q - The queue; NULL to detach. Not owned by the manager.
+ *
+ * Does nothing without HITIME_CMDQ; apply a queue with hitime_apply_cmdq.
+ */
+void
+hitime_set_cmdq(hitime_t *h, hitime_cmdq_t *q)
+{
+#if HITIME_CMDQ
+    h->cmdq = q;
+#else
+    (void)h;
+    (void)q;
+#endif
+}
+
+/**
+ * @brief Attach a trace that records every call; see hitime_trace.h.
+ * @param h
+ * @param tr - The trace; NULL to detach. Not owned by the manager.
+ *
+ * Does nothing without HITIME_TRACE. Attaching records the last time as the
+ * base of the trace. Timeouts already in the manager are not recorded until
+ * they are next started, stopped, touched, or taken; attach before the first
+ * call for the replay to see every timeout.
+ */
+void
+hitime_set_trace(hitime_t *h, hitime_trace_t *tr)
+{
+#if HITIME_TRACE
+    h->trace = tr;
+    if (tr)
+    {
+        hitime_trace_record(tr, HITIME_TRACE_BASE, NULL, h->last, 0, 0);
+    }
+#else
+    (void)h;
+    (void)tr;
+#endif
+}
+
+/**
+ * @brief Add the hitimeout to the manager.
+ * @warn Remember to maintain referential stability! 'hitimeout_t' is a node internally!
+ * @param h
+ * @param t - The hitimeout to add.
+ *
+ * If the hitimeout appears to be a part of a list already, do nothing.
+ * If the hitimeout has already expired then added to expired list.
+ * Otherwise, the hitimeout to the internal data structure for future processing.
+ */
+void
+hitime_start(hitime_t * h, hitimeout_t *t)
+{
+    ht_trace(h, HITIME_TRACE_START, t, t->when, 0);
+
+    /* Timeouts should not be in a list already. */
+    if (UNLIKELY(node_in_list(to_node(t))))
+    {
+        return;
+    }
+
+    /* If this already expired, then add to expired.
+     * Ensures delta in next step is non-zero.
+     */
+    if (UNLIKELY(is_expired(h, t)))
+    {
+        ht_expire_one(h, t);
+#if HITIME_STATS
+        ++h->stats.start_expired;
+#endif
+    }
+    else
+    {
+        ht_nq(h, t);
+    }
+}
+
+/**
+ * Set the timeout to be between the two values.
+ * The objective is to minimize the number of times the
+ * timeout gets handled internally.
+ * @param h
+ * @param t - Timeout to update.
+ * @param min - The minimum expired time.
+ * @param max - The maximum expired time.
+ */
+void
+hitime_start_range(hitime_t *h, hitimeout_t *t, hitime_time_t min, hitime_time_t max)
+{
+    hitime_time_t newwhen;
+    hitime_time_t bits = max ^ min;
+
+    if (LIKELY(bits))
+    {
+        int index = get_high_index64(bits);
+        hitime_time_t mask = ~((((hitime_time_t)1) << index) - 1);
+        newwhen = max & mask;
+    }
+    else
+    {
+        newwhen = max;
+    }
+
+    t->when = newwhen;
+    hitime_start(h, t);
+}
+
+/**
+ * @param h
+ * @param t - The hitimeout to stop.
+ * @brief Stop the timer by removing it from the datastructure.
+ */
+void
+hitime_stop(hitime_t *h, hitimeout_t *t)
+{
+    ht_trace(h, HITIME_TRACE_STOP, t, 0, 0);
+    if (LIKELY(node_in_list(to_node(t))))
+    {
+        /* Unlink must happen or list is never empty. */
+        ht_unlink_only(h, t);
+        node_clear(to_node(t));
+    }
+}
+
+/**
+ * @brief Find the bin of each timeout; HITIME_BINS if expired.
+ *
+ * The times are gathered first, prefetching the timeouts ahead,
+ * so the kernel can take them in blocks.
+ */
+INLINE static void
+ht_classify(hitime_t *h, hitimeout_t **ts, size_t n, uint8_t *index)
+{
+    uint64_t when[HITIME_START_CHUNK];
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (i + HITIME_PREFETCH_AHEAD < n)
+        {
+            PREFETCH(ts[i + HITIME_PREFETCH_AHEAD]);
+        }
+        when[i] = ts[i]->when;
+    }
+
+    hitime_classify(when, n, h->last, index);
+}
+
+#if HITIME_CHUNKED_BINS
+/**
+ * @brief Add the classified timeouts in order.
+ * @param fresh - Skip timeouts that are started; also skips repeats.
+ *
+ * The free slot of the last chunk of each bin is prefetched first.
+ */
+INLINE static void
+ht_place(hitime_t *h, hitimeout_t **ts, const uint8_t *index, size_t n, bool fresh)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (LIKELY(index[i] < HITIME_BINS))
+        {
+            hitime_chunk_t *c = h->bins[index[i]].tail;
+            if (c)
+            {
+                PREFETCH(c->slots + c->len);
+            }
+        }
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        hitimeout_t *t = ts[i];
+
+        if (fresh && UNLIKELY(node_in_list(to_node(t))))
+        {
+            continue;
+        }
+
+        if (LIKELY(index[i] < HITIME_BINS))
+        {
+            ht_nq_found(h, t, index[i]);
+        }
+        else
+        {
+            ht_expire_one(h, t);
+#if HITIME_STATS
+            h->stats.start_expired += fresh;
+#endif
+        }
+    }
+}
+#else
+/**
+ * @brief Add the classified timeouts in order.
+ * @param fresh - Skip timeouts that are started; also skips repeats.
+ *
+ * The tail of each list is prefetched, then the timeouts are chained per
+ * list, and finally each chain is spliced on with one write to the tail.
+ * The chain head of the expired list is slot HITIME_BINS.
+ */
+INLINE static void
+ht_place(hitime_t *h, hitimeout_t **ts, const uint8_t *index, size_t n, bool fresh)
+{
+    hitime_node_t *first[HITIME_BINS + 1];
+    hitime_node_t *last[HITIME_BINS + 1];
+    uint64_t used = 0;
+    bool expired = false;
+#if HITIME_EXACT_WAIT
+    hitime_time_t mins[HITIME_BINS];
+#endif
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        PREFETCH((index[i] < HITIME_BINS ? h->bins[index[i]].prev : h->expired.prev));
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        hitimeout_t *t = ts[i];
+        hitime_node_t *node = to_node(t);
+
+        /* Also skips a timeout given twice since it is chained already. */
+        if (fresh && UNLIKELY(node_in_list(node)))
+        {
+            continue;
+        }
+
+        int bin = index[i];
+        bool has;
+#if HITIME_NEAR_BITS
+        if (bin < HITIME_BINS && ht_is_near(h, t))
+        {
+            ht_near_nq(h, t);
+            continue;
+        }
+#endif
+        ht_count_set(h, t, bin < HITIME_BINS ? bin : COUNT_EXPIRED);
+        if (LIKELY(bin < HITIME_BINS))
+        {
+            node->next = h->bins + bin;
+            has = used & get_bit64(bin);
+            used |= get_bit64(bin);
+#if HITIME_EXACT_WAIT
+            if (!has || t->when < mins[bin])
+            {
+                mins[bin] = t->when;
+            }
+#endif
+        }
+        else
+        {
+            node->next = ht_get_expired(h);
+            has = expired;
+            expired = true;
+#if HITIME_STATS
+            h->stats.start_expired += fresh;
+#endif
+        }
+
+        if (has)
+        {
+            node->prev = last[bin];
+            last[bin]->next = node;
+        }
+        else
+        {
+            first[bin] = node;
+        }
+        last[bin] = node;
+    }
+
+    uint64_t bits = used;
+    while (bits)
+    {
+        int bin = get_low_index64(bits);
+        hitime_node_t *l = h->bins + bin;
+        first[bin]->prev = l->prev;
+        l->prev->next = first[bin];
+        l->prev = last[bin];
+#if HITIME_EXACT_WAIT
+        if (!(h->bitset & get_bit64(bin)) || mins[bin] < h->mins[bin])
+        {
+            h->mins[bin] = mins[bin];
+        }
+#endif
+        bits &= bits - 1;
+    }
+    h->bitset |= used;
+
+    if (expired)
+    {
+        hitime_node_t *l = ht_get_expired(h);
+        first[HITIME_BINS]->prev = l->prev;
+        l->prev->next = first[HITIME_BINS];
+        l->prev = last[HITIME_BINS];
+    }
+}
+#endif
+
+/**
+ * @brief Start at most HITIME_START_CHUNK timeouts.
+ */
+INLINE static void
+ht_start_chunk(hitime_t *h, hitimeout_t **ts, size_t n)
+{
+    uint8_t index[HITIME_START_CHUNK];
+    ht_classify(h, ts, n, index);
+    ht_place(h, ts, index, n, true);
+}
+
+/**
+ * @brief Same as calling hitime_start on each timeout in order.
+ * @param h
+ * @param ts - Array of timeouts; may be reused once the call returns.
+ * @param n - Length of the array.
+ *
+ * Faster for large batches since the timeouts for the same bin are
+ * spliced on together, and the memory for each is prefetched.
+ */
+void
+hitime_start_many(hitime_t *h, hitimeout_t **ts, size_t n)
+{
+#if HITIME_TRACE
+    if (UNLIKELY(h->trace))
+    {
+        size_t i;
+        for (i = 0; i < n; ++i)
+        {
+            ht_trace(h, HITIME_TRACE_START, ts[i], ts[i]->when, 0);
+        }
+    }
+#endif
+
+    while (n > HITIME_START_CHUNK)
+    {
+        ht_start_chunk(h, ts, HITIME_START_CHUNK);
+        ts += HITIME_START_CHUNK;
+        n -= HITIME_START_CHUNK;
+    }
+    if (n)
+    {
+        ht_start_chunk(h, ts, n);
+    }
+}
+
+/**
+ * @brief Same as calling hitime_stop on each timeout in order.
+ * @param h
+ * @param ts - Array of timeouts.
+ * @param n - Length of the array.
+ *
+ * Stopped nodes are scattered so there is nothing to splice; instead the
+ * timeouts are prefetched two steps ahead, then their neighbors one step.
+ */
+void
+hitime_stop_many(hitime_t *h, hitimeout_t **ts, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (i + 2 * HITIME_PREFETCH_AHEAD < n)
+        {
+            PREFETCH(ts[i + 2 * HITIME_PREFETCH_AHEAD]);
+        }
+        if (i + HITIME_PREFETCH_AHEAD < n)
+        {
+            hitime_node_t *ahead = to_node(ts[i + HITIME_PREFETCH_AHEAD]);
+            if (node_in_list(ahead))
+            {
+                PREFETCH(ahead->next);
+#if HITIME_CHUNKED_BINS
+                /* A timeout in a bin only links to its chunk. */
+                if (!slot_in_chunk(ts[i + HITIME_PREFETCH_AHEAD]))
+                {
+                    PREFETCH(ahead->prev);
+                }
+#else
+                PREFETCH(ahead->prev);
+#endif
+            }
+        }
+
+        hitime_stop(h, ts[i]);
+    }
+}
+
+/**
+ * @param h
+ * @param t - Timeout to update.
+ * @param when - The new expired timestamp.
+ * @brief Stop the timeout, if started, restart timeout.
+ */
+void
+hitime_touch(hitime_t *h, hitimeout_t *t, hitime_time_t when)
+{
+    ht_trace(h, HITIME_TRACE_TOUCH, t, when, 0);
+#if HITIME_STATS
+    ++h->stats.touches;
+#endif
+    t->when = when;
+
+    if (node_in_list(to_node(t)))
+    {
+        ht_unlink_only(h, t);
+    }
+
+    if (UNLIKELY(is_expired(h, t)))
+    {
+        ht_expire_one(h, t);
+    }
+    else
+    {
+        ht_nq(h, t);
+    }
+}
+
+/**
+ * @param h
+ * @param t - Timeout to update.
+ * @param when - The new expired timestamp.
+ * @brief Same as hitime_touch, but pushing the timeout later only stores the time.
+ *
+ * The timeout stays in its bin, which is now too low, and the bin is marked
+ * dirty. When a dirty bin triggers its timeouts are re-evaluated instead of
+ * expired in bulk, moving the timeout to where it belongs.
+ * This trades a few extra re-evaluations for not touching the neighboring
+ * nodes and bin on every call.
+ * Without HITIME_LAZY_TOUCH this is hitime_touch.
+ * Do not lazily touch timeouts placed in expiry by hitime_expire_all/bin.
+ */
+void
+hitime_touch_lazy(hitime_t *h, hitimeout_t *t, hitime_time_t when)
+{
+#if HITIME_LAZY_TOUCH
+    if (LIKELY(node_in_list(to_node(t)) && when >= t->when && !is_expired(h, t))
+#if HITIME_NEAR_BITS
+        /* A slot of the ring stands for one time only. */
+        && !ht_is_near(h, t)
+#endif
+       )
+    {
+        /* The bin computed from the old time is at or above the actual bin.
+         * If they differ the actual bin was marked by an earlier touch.
+         */
+        hitime_time_t bits = t->when ^ h->last;
+        h->dirty |= get_bit64(get_high_index64(bits));
+        ht_trace(h, HITIME_TRACE_TOUCH_LAZY, t, when, 0);
+        t->when = when;
+#if HITIME_STATS
+        ++h->stats.lazy_touches;
+#endif
+        return;
+    }
+#endif
+
+    hitime_touch(h, t, when);
+}
+
+/**
+ * @brief Apply the commands other threads posted to the queue.
+ * @param h
+ * @param q - The queue; NULL applies nothing.
+ * @return The number of commands applied.
+ *
+ * With HITIME_CMDQ hitime_timeout does this for the attached queue;
+ * call directly to apply commands sooner, or to apply any other queue.
+ */
+size_t
+hitime_apply_cmdq(hitime_t *h, hitime_cmdq_t *q)
+{
+    size_t count = 0;
+
+    if (NULL == q)
+    {
+        return count;
+    }
+
+    int op;
+    hitimeout_t *t;
+    hitime_time_t when;
+    while (hitime_cmdq_pop(q, &op, &t, &when))
+    {
+        switch (op)
+        {
+            case HITIME_CMD_START:
+                if (!node_in_list(to_node(t)))
+                {
+                    t->when = when;
+                    hitime_start(h, t);
+                }
+                break;
+            case HITIME_CMD_STOP:
+                hitime_stop(h, t);
+                break;
+            default:
+                hitime_touch(h, t, when);
+                break;
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+/**
+ * @brief True if there are timeouts in the bins or the ring.
+ */
+INLINE static bool
+ht_has_pending(hitime_t *h)
+{
+#if HITIME_NEAR_BITS
+    return h->bitset || h->near_words;
+#else
+    return h->bitset;
+#endif
+}
+
+/**
+ * @return Time until the lowest bin triggers; bitset must be non-zero.
+ */
+INLINE static hitime_time_t
+ht_bins_wait(hitime_t *h)
+{
+    int index = get_low_index64(h->bitset);
+    uint64_t mask = get_bit64(index) - 1;
+    return (mask - (mask & h->last)) + 1;
+}
+
+INLINE static hitime_time_t
+ht_get_wait(hitime_t *h)
+{
+    hitime_time_t wait = WAITMAX;
+
+    /* Partial processing left work to be done. */
+    if (UNLIKELY(bin_has(ht_get_processing(h))))
+    {
+        return 0;
+    }
+
+    if (h->bitset)
+    {
+        wait = ht_bins_wait(h);
+    }
+
+#if HITIME_NEAR_BITS
+    hitime_time_t near = ht_near_wait(h);
+    if (near < wait)
+    {
+        wait = near;
+    }
+#endif
+
+    return wait;
+}
+
+/**
+ * @param h
+ * @return The time to wait.
+ */
+hitime_time_t
+hitime_get_wait(hitime_t *h)
+{
+    return ht_get_wait(h);
+}
+
+/**
+ * @param h
+ * @return The earliest time a timeout may expire; max wait if none.
+ *
+ * Without HITIME_EXACT_WAIT this is the next bin boundary.
+ * With it this is the earliest timeout started, which is exact unless the
+ * earliest timeout was stopped; then it is early, never late.
+ */
+hitime_time_t
+hitime_get_deadline(hitime_t *h)
+{
+    if (UNLIKELY(bin_has(ht_get_processing(h))))
+    {
+        return h->last;
+    }
+
+    if (!ht_has_pending(h))
+    {
+        return WAITMAX;
+    }
+
+    hitime_time_t deadline = WAITMAX;
+    if (h->bitset)
+    {
+#if HITIME_EXACT_WAIT
+        /* The bins hold disjoint ranges, ascending with the index. */
+        deadline = h->mins[get_low_index64(h->bitset)];
+#else
+        deadline = h->last + ht_bins_wait(h);
+#endif
+    }
+
+#if HITIME_NEAR_BITS
+    /* The ring is exact either way. */
+    hitime_time_t near = h->last + ht_near_wait(h);
+    if (h->near_words && near < deadline)
+    {
+        deadline = near;
+    }
+#endif
+
+    return deadline;
+}
+
+/**
+ * @param h
+ * @return The time to wait until the deadline.
+ */
+hitime_time_t
+hitime_get_wait_exact(hitime_t *h)
+{
+    /* A deadline at the end of time is not the same as no deadline. */
+    if (!ht_has_pending(h) && !bin_has(ht_get_processing(h)))
+    {
+        return WAITMAX;
+    }
+
+    return hitime_get_deadline(h) - h->last;
+}
+
+/**
+ * @param h
+ * @param now - The current time.
+ * @return The time to wait using the current now without updating.
+ */
+hitime_time_t
+hitime_get_wait_with(hitime_t *h, hitime_time_t now)
+{
+    hitime_time_t diff = now - h->last;
+    hitime_time_t w = ht_get_wait(h);
+    return diff < w ? (w - diff) : 0;
+}
+
+/**
+ * @brief First bin always expires since there is a guaranteed hitimeout
+ *        of granularity 1.
+ */
+INLINE static void
+ht_expire_first(hitime_t *h)
+{
+    if (UNLIKELY(ht_get_dirty(h) & 1))
+    {
+        ht_take_bin(h, 0, false);
+    }
+    else
+    {
+        ht_take_bin(h, 0, true);
+    }
+}
+
+/**
+ * @brief Expire bins in bulk below a certain threshold.
+ * @return Index of final bin processed.
+ */
+INLINE static int
+ht_expire_bulk(hitime_t *h, hitime_time_t now)
+{
+    int index = 1;
+    hitime_time_t elapsed = get_elpased(now, h->last);
+
+    /* NOTE:
+     * If the elapsed time is less than the needed (wait time)
+     * then we check bins needlessly.
+     * The bitset makes this a single mask so there is no need to store
+     * the wait time as well.
+     */
+
+    /* Get index of guaranteed expires. */
+    int index_max = get_high_index64(elapsed);
+    if (index < index_max)
+    {
+        /* Lazily touched timeouts may not be expired yet. */
+        uint64_t mask = get_range64(index, index_max);
+        uint64_t dirty = mask & ht_get_dirty(h);
+        ht_take_bins(h, dirty, false);
+        ht_take_bins(h, mask & ~dirty, true);
+        index = index_max;
+    }
+
+    return index;
+}
+
+/**
+ * @return The max index of bins to review.
+ */
+INLINE static void
+ht_process_setup(hitime_t *h, int index, hitime_time_t now)
+{
+    hitime_time_t bits = now ^ h->last;
+    int max_index = get_high_index64(bits);
+
+    if (index <= max_index)
+    {
+        ht_take_bins(h, get_range64(index, max_index + 1), false);
+    }
+}
+
+#if HITIME_CHUNKED_BINS
+/**
+ * @brief Process the timeouts of a chunk from the start up to the end.
+ *        The chunk is already an array of timeouts to classify.
+ */
+INLINE static void
+ht_process_chunk(hitime_t *h, hitime_chunk_t *c, size_t end)
+{
+    uint8_t index[HITIME_START_CHUNK];
+    size_t i;
+
+    for (i = 0; i < end; i += HITIME_START_CHUNK)
+    {
+        size_t n = end - i < HITIME_START_CHUNK ? end - i : HITIME_START_CHUNK;
+        ht_classify(h, c->slots + i, n, index);
+        ht_stat_cascade(h, index, n);
+        ht_place(h, c->slots + i, index, n, false);
+    }
+}
+
+INLINE static void
+ht_process_all(hitime_t *h)
+{
+    hitime_bin_t *p = ht_get_processing(h);
+    hitime_chunk_t *c = p->head;
+    bin_clear(p);
+
+    while (c)
+    {
+        hitime_chunk_t *next = c->next;
+        ht_process_chunk(h, c, c->len);
+        ht_chunk_release(h, c);
+        c = next;
+    }
+}
+
+/**
+ * @brief Same as ht_process_all, but stops after max timeouts.
+ *        Whatever is left stays in the processing bin for the next call.
+ */
+INLINE static void
+ht_process_some(hitime_t *h, int max)
+{
+    hitime_bin_t *p = ht_get_processing(h);
+    hitime_chunk_t *c = p->head;
+    size_t left = (size_t)max;
+
+    while (c && left)
+    {
+        if (c->len <= left)
+        {
+            left -= c->len;
+            p->head = c->next;
+            if (p->head)
+            {
+                p->head->prev = NULL;
+            }
+            else
+            {
+                p->tail = NULL;
+            }
+            ht_process_chunk(h, c, c->len);
+            ht_chunk_release(h, c);
+            c = p->head;
+        }
+        else
+        {
+            /* Shift the remainder to the front so the chunk stays dense. */
+            ht_process_chunk(h, c, left);
+            size_t i;
+            for (i = left; i < c->len; ++i)
+            {
+                c->slots[i - left] = c->slots[i];
+                slot_set(c->slots[i - left], c, i - left);
+            }
+            c->len -= left;
+            left = 0;
+        }
+    }
+}
+#else
+/**
+ * @brief Process up to max timeouts of the processing list at once.
+ * @param curr - Node to start at; updated to the node after the last processed.
+ * @return The number of timeouts processed.
+ *
+ * The whole block is taken off before any are placed, so the links
+ * followed are never the ones being rewritten.
+ */
+INLINE static size_t
+ht_process_block(hitime_t *h, hitime_node_t **curr, size_t max)
+{
+    hitime_node_t *l = ht_get_processing(h);
+    hitimeout_t *ts[HITIME_START_CHUNK];
+    uint64_t when[HITIME_START_CHUNK];
+    uint8_t index[HITIME_START_CHUNK];
+    hitime_node_t *n = *curr;
+    size_t len = 0;
+
+    while (n != l && len < max)
+    {
+        ts[len] = to_timeout(n);
+        when[len] = ts[len]->when;
+        ++len;
+        n = n->next;
+    }
+    *curr = n;
+
+    hitime_classify(when, len, h->last, index);
+    ht_stat_cascade(h, index, len);
+    ht_place(h, ts, index, len, false);
+
+    return len;
+}
+
+INLINE static void 
+ht_process_all(hitime_t *h)
+{
+    hitime_node_t *l = ht_get_processing(h);
+    hitime_node_t *curr = l->next;
+    while (curr != l)
+    {
+        ht_process_block(h, &curr, HITIME_START_CHUNK);
+    }
+    list_clear(l);
+}
+
+/**
+ * @brief Same as ht_process_all, but stops after max timeouts.
+ *        Whatever is left stays in the processing list for the next call.
+ */
+INLINE static void
+ht_process_some(hitime_t *h, int max)
+{
+    hitime_node_t *l = ht_get_processing(h);
+    hitime_node_t *curr = l->next;
+    size_t left = (size_t)max;
+    while (curr != l && left)
+    {
+        left -= ht_process_block(h, &curr, left < HITIME_START_CHUNK ? left : HITIME_START_CHUNK);
+    }
+
+    /* Reattach the remainder; clears the list if nothing remains. */
+    l->next = curr;
+    curr->prev = l;
+}
+#endif
+
+INLINE static void
+ht_update_last(hitime_t *h, hitime_time_t now)
+{
+    h->last = now;
+}
+
+/**
+ * @brief Expire and gather the bins triggered by the new time.
+ *        Leaves the gathered timeouts in the processing list.
+ */
+INLINE static void
+ht_advance(hitime_t *h, hitime_time_t now)
+{
+#if HITIME_PHASES
+    h->phase_top = get_high_index64(now ^ h->last);
+#endif
+    uint64_t tick = ht_ticks();
+#if HITIME_NEAR_BITS
+    ht_near_expire(h, now - h->last);
+#endif
+    ht_expire_first(h);
+    ht_phase_lap(h, HITIME_PHASE_EXPIRE_FIRST, &tick);
+    int index = ht_expire_bulk(h, now);
+    ht_phase_lap(h, HITIME_PHASE_EXPIRE_BULK, &tick);
+    ht_process_setup(h, index, now);
+    ht_phase_lap(h, HITIME_PHASE_PROCESS_SETUP, &tick);
+    ht_update_last(h, now);
+}
+
+/**
+ * @brief Same as ht_process_all, but timed.
+ */
+INLINE static void
+ht_process_timed(hitime_t *h, int max)
+{
+    uint64_t tick = ht_ticks();
+    if (max > 0)
     {
-        int index = get_high_index64(bits);
-        uint64_t mask = ~((((uint64_t)1) << index) - 1);
-        newwhen = max & mask;
+        ht_process_some(h, max);
     }
     else
     {
-        newwhen = max;
+        ht_process_all(h);
     }
-
-    t->when = newwhen;
-    hitime_start(h, t);
+    ht_phase_lap(h, HITIME_PHASE_PROCESS_ALL, &tick);
 }
 
 /**
+ * @brief Move any expired hitimeouts to expired list.
  * @param h
- * @param t - The hitimeout to stop.
- * @brief Stop the timer by removing it from the datastructure.
+ * @param delta - The amount of time elapsed since the last time.
+ * @return False if nothing expired; true otherwise.
  */
-void
-hitime_stop(hitime_t *, hitimeout_t *t)
+bool
+hitime_timeout_elapse(hitime_t *h, hitime_time_t delta)
 {
-    if (LIKELY(node_in_list(to_node(t))))
-    {
-        /* Unlink must happen or list is never empty. */
-        node_unlink(to_node(t));
-    }
+    hitime_time_t now = h->last + delta;
+    if (now < h->last) { now = WAITMAX; }
+    return hitime_timeout(h, now);
 }
 
 /**
+ * @brief Move any expired hitimeouts to expired list.
  * @param h
- * @param t - Timeout to update.
- * @param when - The new expired timestamp.
- * @brief Stop the timeout, if started, restart timeout.
+ * @param now - The current time.
+ * @return False if nothing expired (or invalid 'now' given); true otherwise.
+ *
+ * With HITIME_CMDQ commands posted to the attached queue are applied first.
+ * Pending work of hitime_timeout_partial is finished even if 'now' is not past
+ * the last time.
  */
-void
-hitime_touch(hitime_t *h, hitimeout_t *t, uint64_t when)
+bool
+hitime_timeout(hitime_t *h, hitime_time_t now)
 {
-    t->when = when;
+#if HITIME_STATS
+    ht_mark_t mark;
+    ht_stat_begin(h, &mark);
+#endif
 
-    if (node_in_list(to_node(t)))
+#if HITIME_CMDQ
+    if (UNLIKELY(h->cmdq))
     {
-        node_unlink_only(to_node(t));
+        hitime_apply_cmdq(h, h->cmdq);
     }
+#endif
+    ht_trace(h, HITIME_TRACE_TIMEOUT, NULL, now, 0);
 
-    if (UNLIKELY(is_expired(h, t)))
+    /* Work left pending by hitime_timeout_partial is finished either way. */
+    bool work = now > h->last;
+    if (LIKELY(work))
     {
-        list_nq(ht_get_expired(h), to_node(t));
+        ht_advance(h, now);
+        ht_process_timed(h, 0);
     }
-    else
+    else if (UNLIKELY(bin_has(ht_get_processing(h))))
     {
-        ht_nq(h, t);
+        ht_process_timed(h, 0);
+        work = true;
     }
+
+#if HITIME_STATS
+    ht_stat_end(h, &mark);
+#endif
+    return work && !list_is_empty(ht_get_expired(h));
 }
 
-INLINE static uint64_t
-ht_get_wait(hitime_t *h)
+/**
+ * @brief Move expired hitimeouts to expired list, doing a bounded amount of work.
+ * @param h
+ * @param now - The current time; may equal the last time to resume processing.
+ * @param max - The most timeouts to process; non-positive processes all.
+ * @return False if nothing expired; true otherwise.
+ *
+ * Timeouts from triggered bins that are not yet processed stay in the manager
+ * and are resumed by the next call (partial or not).
+ * While there is work pending hitime_get_wait returns zero.
+ * Stopping or touching a pending timeout is allowed.
+ */
+bool
+hitime_timeout_partial(hitime_t *h, hitime_time_t now, int max)
 {
-    uint64_t wait = WAITMAX;
+#if HITIME_STATS
+    ht_mark_t mark;
+    ht_stat_begin(h, &mark);
+#endif
 
-    int index = 0;
-    for (; index < HITIME_BINS; ++index)
+#if HITIME_CMDQ
+    if (UNLIKELY(h->cmdq))
     {
-        if (list_has((h->bins) + index))
-        {
-            uint64_t msb = ((uint64_t)1) << index;
-            uint64_t mask = msb - 1;
-            wait = (mask - (mask & h->last)) + 1;
-            break;
-        }
+        hitime_apply_cmdq(h, h->cmdq);
     }
+#endif
+    ht_trace(h, HITIME_TRACE_PARTIAL, NULL, now, max);
 
-    return wait;
-}
+    if (now > h->last)
+    {
+        ht_advance(h, now);
+    }
 
-/**
- * @param h
- * @return The time to wait.
- */
-uint64_t
-hitime_get_wait(hitime_t *h)
-{
-    return ht_get_wait(h);
-}
+    ht_process_timed(h, max);
 
-/**
- * @param h
- * @param now - The current time.
- * @return The time to wait using the current now without updating.
- */
-uint64_t
-hitime_get_wait_with(hitime_t *h, uint64_t now)
-{
-    uint64_t diff = now - h->last;
-    uint64_t w = ht_get_wait(h);
-    return diff < w ? (w - diff) : 0;
+#if HITIME_STATS
+    ht_stat_end(h, &mark);
+#endif
+    return !list_is_empty(ht_get_expired(h));
 }
 
 /**
- * @brief First bin always expires since there is a guaranteed hitimeout
- *        of granularity 1.
+ * @brief Copy the stats of the manager.
+ * @param h
+ * @param s - Filled with the stats; all zero without HITIME_STATS.
  */
-INLINE static void
-ht_expire_first(hitime_t *h)
+void
+hitime_get_stats(hitime_t *h, hitime_stats_t *s)
 {
-    list_append(ht_get_expired(h), h->bins);
+#if HITIME_STATS
+    *s = h->stats;
+#else
+    (void)h;
+    memset(s, 0, sizeof(*s));
+#endif
 }
 
 /**
- * @brief Expire bins in bulk below a certain threshold.
- * @return Index of final bin processed.
+ * @brief Start the stats over from zero.
+ * @param h
  */
-INLINE static int
-ht_expire_bulk(hitime_t *h, uint64_t now)
+void
+hitime_reset_stats(hitime_t *h)
 {
-    int index = 1;
-    uint64_t elapsed = get_elpased(now, h->last);
-
-    /* NOTE:
-     * If the elapsed time is less than the needed (wait time)
-     * then we check bins needlessly.
-     * However, storing the wait time and checking it will likely consume as much
-     * time so we don't perform that optimization.
-     * Also, juggling one more item of state doesn't seem worthwhile.
-     */
-
-    /* Get index of guaranteed expires. */
-    int index_max = get_high_index64(elapsed);
-    for (; index < index_max; ++index)
-    {
-        hitime_node_t *l = h->bins + index;
-        list_append(ht_get_expired(h), l);
-    }
-
-    return index;
+#if HITIME_STATS
+    memset(&h->stats, 0, sizeof(h->stats));
+#else
+    (void)h;
+#endif
 }
 
 /**
- * @return The max index of bins to review.
+ * @brief Summarize the time spent in each phase of hitime_timeout.
+ * @param h
+ * @param s - HITIME_PHASE_COUNT summaries; zero without HITIME_PHASES.
+ * @param bins - Optional; HITIME_PHASE_COUNT entries given the highest bin
+ *               triggered by the slowest call of each phase; -1 if none.
  */
-INLINE static void
-ht_process_setup(hitime_t *h, int index, uint64_t now)
-{
-    uint64_t bits = now ^ h->last;
-    int max_index = get_high_index64(bits);
-
-    for (; index <= max_index; ++index)
-    {
-        hitime_node_t *l = h->bins + index;
-        list_append(ht_get_processing(h), l);
-    }
-}
-
-INLINE static void 
-ht_process_all(hitime_t *h)
+void
+hitime_get_phases(hitime_t *h, hitime_summary_t *s, int *bins)
 {
-    hitime_node_t *l = ht_get_processing(h);
-    hitime_node_t *curr = l->next;
-    while (curr != l)
+    int i;
+    for (i = 0; i < HITIME_PHASE_COUNT; ++i)
     {
-        hitime_node_t *next = curr->next;
-
-        hitimeout_t *t = to_timeout(curr);
-        if (UNLIKELY(is_expired(h, t)))
+#if HITIME_PHASES
+        hitime_hist_summarize(h->phases + i, s + i);
+        if (bins)
         {
-            list_nq(ht_get_expired(h), curr);
+            bins[i] = h->phases[i].count ? h->phase_bins[i] : -1;
         }
-        else
+#else
+        (void)h;
+        memset(s + i, 0, sizeof(*s));
+        if (bins)
         {
-            ht_nq(h, t);
+            bins[i] = -1;
         }
-
-        curr = next;
+#endif
     }
-    list_clear(l);
 }
 
-INLINE static void
-ht_update_last(hitime_t *h, uint64_t now)
+/**
+ * @brief Empty the phase histograms.
+ * @param h
+ */
+void
+hitime_reset_phases(hitime_t *h)
 {
-    h->last = now;
+#if HITIME_PHASES
+    int i;
+    for (i = 0; i < HITIME_PHASE_COUNT; ++i)
+    {
+        hitime_hist_reset(h->phases + i);
+        h->phase_bins[i] = -1;
+    }
+    h->phase_top = -1;
+#else
+    (void)h;
+#endif
 }
 
 /**
- * @brief Move any expired hitimeouts to expired list.
+ * @brief Summarize how late expired timeouts were taken.
  * @param h
- * @param delta - The amount of time elapsed since the last time.
- * @return False if nothing expired; true otherwise.
+ * @param s - Zero without HITIME_LATENESS.
+ *
+ * Lateness is the last time given minus the time of the timeout as it is
+ * taken by hitime_get_next or hitime_drain; hitime_take_expired is not counted.
  */
-bool
-hitime_timeout_elapse(hitime_t *h, uint64_t delta)
+void
+hitime_get_lateness(hitime_t *h, hitime_summary_t *s)
 {
-    uint64_t now = h->last + delta;
-    if (now < h->last) { now = UINT64_MAX; }
-    return hitime_timeout(h, now);
+#if HITIME_LATENESS
+    hitime_hist_summarize(&h->lateness, s);
+#else
+    (void)h;
+    memset(s, 0, sizeof(*s));
+#endif
 }
 
 /**
- * @brief Move any expired hitimeouts to expired list.
+ * @brief Empty the lateness histogram.
  * @param h
- * @param now - The current time.
- * @return False if nothing expired (or invalid 'now' given); true otherwise.
  */
-bool
-hitime_timeout(hitime_t *h, uint64_t now)
+void
+hitime_reset_lateness(hitime_t *h)
 {
-    if (UNLIKELY(now <= h->last)) { return false; }
-
-    ht_expire_first(h);
-    int index = ht_expire_bulk(h, now);
-    ht_process_setup(h, index, now);
-    ht_update_last(h, now);
-    ht_process_all(h);
-    return !list_is_empty(ht_get_expired(h));
+#if HITIME_LATENESS
+    hitime_hist_reset(&h->lateness);
+#else
+    (void)h;
+#endif
 }
 
 /**
@@ -631,17 +2080,20 @@ hitime_timeout(hitime_t *h, uint64_t now)
 void
 hitime_expire_all(hitime_t * h)
 {
-    hitime_node_t *ls = h->bins;
-    // Iterate through core bins/lists.
-    int i;
-    for (i = 0; i < HITIME_BINS; ++i)
-    {
-        hitime_node_t *l = ls + i;
-        list_append(ht_get_expired(h), l);
-    }
+    ht_trace(h, HITIME_TRACE_EXPIRE_ALL, NULL, 0, 0);
+
+#if HITIME_NEAR_BITS
+    ht_near_expire(h, HITIME_NEAR_SLOTS);
+#endif
+
+    // Iterate through occupied core bins/lists.
+    ht_take_bins(h, UINT64_MAX, true);
 
     // Move everything from the process list to expired.
-    list_append(ht_get_expired(h), ht_get_processing(h));
+    if (bin_has(ht_get_processing(h)))
+    {
+        ht_bin_move(h, ht_get_processing(h), true);
+    }
 }
 
 /**
@@ -652,69 +2104,135 @@ hitimeout_t *
 hitime_get_next(hitime_t *h)
 {
     hitime_node_t *n = list_dq(ht_get_expired(h));
-    return n ? to_timeout(n) : NULL;
+    if (!n)
+    {
+        return NULL;
+    }
+    ht_count_clear(h, to_timeout(n));
+    ht_late(h, to_timeout(n));
+    ht_trace(h, HITIME_TRACE_NEXT, to_timeout(n), 0, 0);
+    return to_timeout(n);
 }
 
-uint64_t
-hitime_max_wait(void)
+/**
+ * @brief Hand expired timeouts to the callback.
+ * @param h
+ * @param cb - Called with each timeout and the context.
+ * @param ctx
+ * @param max - Maximum number of timeouts to hand over; zero or less for all.
+ * @return The number of timeouts handed to the callback.
+ *
+ * The expired list is detached up front and walked once; each timeout only
+ * has its own links cleared before the callback is given it, and whatever was
+ * not handed over is put back in front of the list with one splice.
+ * The callback may restart, stop, or touch the timeout it was given and any
+ * timeout that is not expired. Timeouts it expires wait for the next call.
+ * @warn The expired timeouts not yet handed over are off the expired list
+ *       until the call returns; the callback must not stop or touch them.
+ * The node after next and the data of the next timeout are prefetched
+ * before each call.
+ */
+int
+hitime_drain(hitime_t *h, hitime_drain_cb cb, void *ctx, int max)
 {
-    return WAITMAX;
-}
+    hitime_node_t *l = ht_get_expired(h);
+    hitime_node_t *n = l->next;
+    hitime_node_t *last = l->prev;
+    int count = 0;
 
-uint64_t
-hitime_get_last(hitime_t *h)
-{
-    return h->last;
-}
+    if (max <= 0)
+    {
+        max = INT_MAX;
+    }
 
-/*******************************************************************************
- * ALLOC FUNCTIONS
-*******************************************************************************/
+    /* The detached timeouts still end at the head, which marks the end. */
+    list_clear(l);
 
-static void
-_hitime_abort(bool is_malloc, size_t size)
-{
-    const char msg[] = "hitime %salloc(%zu) failure";
+    while (n != l && count < max)
+    {
+        hitime_node_t *next = n->next;
+        if (next != l)
+        {
+            PREFETCH(next->next);
+            PREFETCH(to_timeout(next)->data);
+        }
+        hitimeout_t *t = to_timeout(n);
+        node_clear(n);
+        ht_count_clear(h, t);
+        ht_late(h, t);
+        ht_trace(h, HITIME_TRACE_NEXT, t, 0, 0);
+        cb(t, ctx);
+        ++count;
+        n = next;
+    }
 
-    /* The 2 is for the prefix "re".
-     * Note that 2**64 is actually 20 max chars, good to have space.
-     */
-    char buf[sizeof(msg) + 2 + 32];
+    if (n != l)
+    {
+        /* Ahead of anything the callbacks expired. */
+        n->prev = l;
+        last->next = l->next;
+        l->next->prev = last;
+        l->next = n;
+    }
 
-    snprintf(buf, sizeof(buf), msg, is_malloc ? "m" : "re", size);
-    perror(buf);
-    abort();
+    return count;
 }
 
-INLINE static void *
-_hitime_rawalloc_impl(size_t size)
+/**
+ * @brief Move every expired timeout to the given list in O(1).
+ * @param h
+ * @param l - List head; overwritten. Must not move while it has timeouts.
+ *
+ * Take them off with hitime_list_next; they may also be stopped as usual.
+ */
+void
+hitime_take_expired(hitime_t *h, hitime_node_t *l)
 {
-    void *mem = malloc(size);
-    if (UNLIKELY(!mem))
-    {
-        _hitime_abort(true, size);
-    }
-    return mem;
+    ht_trace(h, HITIME_TRACE_TAKE, NULL, 0, 0);
+    list_clear(l);
+    ht_count_list(h, ht_get_expired(h), -1);
+    list_append(l, ht_get_expired(h));
 }
 
-/*
- * Don't check for NULL since hitime_free does operations
- * that would cause segfault anyways.
+/**
+ * @param l - List filled by hitime_take_expired.
+ * @return The next timeout of the list; NULL if none.
  */
-INLINE static void
-_hitime_rawfree_impl(void *mem)
+hitimeout_t *
+hitime_list_next(hitime_node_t *l)
+{
+    hitime_node_t *n = list_dq(l);
+    return n ? to_timeout(n) : NULL;
+}
+
+hitime_time_t
+hitime_max_wait(void)
 {
-    free(mem);
+    return WAITMAX;
 }
 
+hitime_time_t
+hitime_get_last(hitime_t *h)
+{
+    return h->last;
+}
 
 /*******************************************************************************
  * TIMEOUT FUNCTIONS
 *******************************************************************************/
 
+/**
+ * @return Initialized timeout from the default pool if set, malloc otherwise.
+ */
 hitimeout_t *
 hitimeout_new(void)
 {
+    hitime_pool_t *p = hitime_pool_get_default();
+    if (p)
+    {
+        return hitime_pool_alloc(p);
+    }
+
     hitimeout_t *t = hitime_rawalloc(sizeof(hitimeout_t));
     hitimeout_init(t);
     return t;
@@ -723,8 +2241,16 @@ hitimeout_new(void)
 void
 hitimeout_free(hitimeout_t **t)
 {
-    hitimeout_destroy(*t);
-    hitime_rawfree(*t);
+    hitime_pool_t *p = hitime_pool_get_default();
+    if (p)
+    {
+        hitime_pool_release(p, *t);
+    }
+    else
+    {
+        hitimeout_destroy(*t);
+        hitime_rawfree(*t);
+    }
     *t = NULL;
 }
 
@@ -739,7 +2265,7 @@ hitimeout_free(hitimeout_t **t)
 hitime_t *
 hitime_new(void)
 {
-    hitime_t *h = hitime_rawalloc(sizeof(hitime_t));
+    hitime_t *h = hitime_rawalloc_aligned(_Alignof(hitime_t), sizeof(hitime_t));
     hitime_init(h);
     return h;
 }
@@ -797,8 +2323,7 @@ hitime_expire_bin(hitime_t *h, int index)
         return;
     }
 
-    hitime_node_t *l = (h->bins) + index;
-    list_append(ht_get_expired(h), l);
+    ht_take_bin(h, index, true);
 }
 
 /**
@@ -807,7 +2332,7 @@ hitime_expire_bin(hitime_t *h, int index)
  * @param index - The index of the bin to count.
  * @return The count of items in the specified bin; zero on invalid bin.
  */
-int
+uint64_t
 hitime_count_bin(hitime_t *h, int index)
 {
     if (UNLIKELY(index < 0 || index >= HITIME_BINS))
@@ -815,22 +2340,42 @@ hitime_count_bin(hitime_t *h, int index)
         return 0;
     }
 
-    return list_count((h->bins) + index);
+#if HITIME_COUNTS
+    return h->counts[index];
+#else
+    return (uint64_t)bin_count((h->bins) + index);
+#endif
 }
 
 /**
  * @return The count of all timeouts in the datastructure, excluding expired.
+ *         Timeouts pending in partial work count, they have yet to expire.
+ *         O(1) with HITIME_COUNTS, otherwise walks every bin.
  */
-int
+uint64_t
 hitime_count_all(hitime_t *h)
 {
-    int count = 0;
+    uint64_t count = 0;
 
     int i;
+#if HITIME_COUNTS
+    for (i = 0; i <= COUNT_PROCESSING; ++i)
+    {
+        count += h->counts[i];
+    }
+#else
+    count += (uint64_t)bin_count(ht_get_processing(h));
     for (i = 0; i < HITIME_BINS; ++i)
     {
-        count += list_count((h->bins) + i);
+        count += (uint64_t)bin_count((h->bins) + i);
+    }
+#if HITIME_NEAR_BITS
+    for (i = 0; i < HITIME_NEAR_SLOTS; ++i)
+    {
+        count += (uint64_t)bin_count((h->near) + i);
     }
+#endif
+#endif
 
     return count;
 }
@@ -838,10 +2383,14 @@ hitime_count_all(hitime_t *h)
 /**
  * @return The count of all timeouts in the expired list.
  */
-int
+uint64_t
 hitime_count_expired(hitime_t *h)
 {
-    return list_count(ht_get_expired(h));
+#if HITIME_COUNTS
+    return h->counts[COUNT_EXPIRED];
+#else
+    return (uint64_t)list_count(ht_get_expired(h));
+#endif
 }
 
 /**
@@ -850,13 +2399,26 @@ hitime_count_expired(hitime_t *h)
 void
 hitime_dump_stats(hitime_t *h)
 {
-    printf("NOW: %lu\nEXPIRED: %d\nPROCESSING: %d\nBINS:\n",
-           h->last, list_count(ht_get_expired(h)), list_count(ht_get_processing(h)));
+    printf("NOW: %" PRIu64 "\nBITSET: %016" PRIx64 "\nEXPIRED: %" PRIu64 "\nPROCESSING: %d\nBINS:\n",
+           (uint64_t)h->last, (uint64_t)h->bitset,
+           hitime_count_expired(h), bin_count(ht_get_processing(h)));
 
     int i;
     for (i = 0; i < HITIME_BINS; ++i)
     {
-        printf("%d: %d\n", i, list_count((h->bins) + i));
+        printf("%d: %" PRIu64 "\n", i, hitime_count_bin(h, i));
+    }
+#if HITIME_NEAR_BITS
+#if HITIME_COUNTS
+    uint64_t near = h->counts[COUNT_NEAR];
+#else
+    uint64_t near = 0;
+    for (i = 0; i < HITIME_NEAR_SLOTS; ++i)
+    {
+        near += (uint64_t)bin_count((h->near) + i);
     }
+#endif
+    printf("NEAR: %" PRIu64 "\n", near);
+#endif
 }
 
@@ -0,0 +1,526 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_arena.c
+ * @author Craig Jacobson
+ * @brief Compact timeout manager implementation.
+ *
+ * Mirrors hitime.c with indices in place of pointers. Times are kept relative
+ * to an epoch; once the last time reaches 2**31 every stored time has that
+ * bit set, so the epoch moves forward by 2**31 without moving any timeouts.
+ */
+
+#include "hitime_arena.h"
+#include "hitime_util.h"
+
+
+
+/*******************************************************************************
+ * HELPER FUNCTIONS
+*******************************************************************************/
+
+enum
+{
+    EXPIRED = HITIME_ARENA_BINS,
+    PROCESSING,
+    HEADS,
+};
+
+static const uint64_t WAITMAX = UINT64_MAX;
+static const uint32_t REBASE = ((uint32_t)1) << 31;
+static const uint32_t NIL = HITIME_ARENA_NIL;
+
+/**
+ * @return Mask of the bits in the range [low, high).
+ */
+INLINE static uint32_t
+get_range32(int low, int high)
+{
+    uint32_t hmask = high >= 32 ? UINT32_MAX : get_bit32(high) - 1;
+    uint32_t lmask = get_bit32(low) - 1;
+    return hmask & ~lmask;
+}
+
+INLINE static hitime_anode_t *
+get_node(hitime_arena_t *a, uint32_t i)
+{
+    return a->nodes + i;
+}
+
+INLINE static bool
+is_expired(hitime_arena_t *a, uint32_t i)
+{
+    return get_node(a, i)->when <= a->last;
+}
+
+/*******************************************************************************
+ * LIST FUNCTIONS
+*******************************************************************************/
+
+INLINE static bool
+node_in_list(hitime_arena_t *a, uint32_t i)
+{
+    return NIL != get_node(a, i)->next;
+}
+
+INLINE static void
+node_clear(hitime_arena_t *a, uint32_t i)
+{
+    get_node(a, i)->next = NIL;
+    get_node(a, i)->prev = NIL;
+}
+
+INLINE static void
+node_unlink_only(hitime_arena_t *a, uint32_t i)
+{
+    hitime_anode_t *n = get_node(a, i);
+    get_node(a, n->next)->prev = n->prev;
+    get_node(a, n->prev)->next = n->next;
+}
+
+INLINE static void
+list_clear(hitime_arena_t *a, uint32_t l)
+{
+    get_node(a, l)->next = l;
+    get_node(a, l)->prev = l;
+}
+
+INLINE static bool
+list_is_empty(hitime_arena_t *a, uint32_t l)
+{
+    return l == get_node(a, l)->next;
+}
+
+INLINE static void
+list_nq(hitime_arena_t *a, uint32_t l, uint32_t i)
+{
+    hitime_anode_t *head = get_node(a, l);
+    hitime_anode_t *n = get_node(a, i);
+    n->next = l;
+    n->prev = head->prev;
+    get_node(a, head->prev)->next = i;
+    head->prev = i;
+}
+
+INLINE static uint32_t
+list_dq(hitime_arena_t *a, uint32_t l)
+{
+    uint32_t i = NIL;
+
+    if (!list_is_empty(a, l))
+    {
+        i = get_node(a, l)->next;
+        node_unlink_only(a, i);
+        node_clear(a, i);
+    }
+
+    return i;
+}
+
+/**
+ * @brief Append items from l2 to l1.
+ */
+INLINE static void
+list_append(hitime_arena_t *a, uint32_t l1, uint32_t l2)
+{
+    if (!list_is_empty(a, l2))
+    {
+        hitime_anode_t *h1 = get_node(a, l1);
+        hitime_anode_t *h2 = get_node(a, l2);
+        get_node(a, h2->next)->prev = h1->prev;
+        get_node(a, h2->prev)->next = l1;
+        get_node(a, h1->prev)->next = h2->next;
+        h1->prev = h2->prev;
+        list_clear(a, l2);
+    }
+}
+
+/*******************************************************************************
+ * ARENA HELPERS
+*******************************************************************************/
+
+INLINE static void
+ar_nq(hitime_arena_t *a, uint32_t i)
+{
+    uint32_t bits = get_node(a, i)->when ^ a->last;
+    int index = get_high_index32(bits);
+    list_nq(a, (uint32_t)index, i);
+    a->bitset |= get_bit32(index);
+}
+
+/**
+ * @brief Move the contents of every bin in the mask to the given list.
+ */
+INLINE static void
+ar_take_bins(hitime_arena_t *a, uint32_t l, uint32_t mask)
+{
+    uint32_t bits = mask & a->bitset;
+    a->bitset &= ~mask;
+
+    while (bits)
+    {
+        list_append(a, l, (uint32_t)get_low_index32(bits));
+        bits &= bits - 1;
+    }
+}
+
+/**
+ * @brief Unlink the node and clear the bin's bit if it was the last one.
+ */
+INLINE static void
+ar_unlink_only(hitime_arena_t *a, uint32_t i)
+{
+    uint32_t prev = get_node(a, i)->prev;
+    node_unlink_only(a, i);
+
+    if (UNLIKELY(prev < HITIME_ARENA_BINS && list_is_empty(a, prev)))
+    {
+        a->bitset &= ~get_bit32((int)prev);
+    }
+}
+
+INLINE static void
+ar_advance(hitime_arena_t *a, uint32_t now)
+{
+    int index = 1;
+
+    ar_take_bins(a, EXPIRED, 1);
+
+    /* Bins entirely below the elapsed time expire in bulk. */
+    int index_max = get_high_index32(now - a->last);
+    if (index < index_max)
+    {
+        ar_take_bins(a, EXPIRED, get_range32(index, index_max));
+        index = index_max;
+    }
+
+    int max_index = get_high_index32(now ^ a->last);
+    if (index <= max_index)
+    {
+        ar_take_bins(a, PROCESSING, get_range32(index, max_index + 1));
+    }
+
+    a->last = now;
+}
+
+INLINE static void
+ar_process_all(hitime_arena_t *a)
+{
+    uint32_t curr = get_node(a, PROCESSING)->next;
+    while (PROCESSING != curr)
+    {
+        uint32_t next = get_node(a, curr)->next;
+
+        if (UNLIKELY(is_expired(a, curr)))
+        {
+            list_nq(a, EXPIRED, curr);
+        }
+        else
+        {
+            ar_nq(a, curr);
+        }
+
+        curr = next;
+    }
+    list_clear(a, PROCESSING);
+}
+
+/**
+ * @brief Move the epoch forward by 2**31.
+ *
+ * Every started timeout is at or after the last time, which has the top bit
+ * set, so clearing the bit keeps every timeout in the same bin.
+ * Expired timeouts are left alone; their time is no longer meaningful.
+ */
+static void
+ar_rebase(hitime_arena_t *a)
+{
+    uint32_t bits = a->bitset;
+    while (bits)
+    {
+        uint32_t l = (uint32_t)get_low_index32(bits);
+        uint32_t curr = get_node(a, l)->next;
+        while (l != curr)
+        {
+            get_node(a, curr)->when -= REBASE;
+            curr = get_node(a, curr)->next;
+        }
+        bits &= bits - 1;
+    }
+
+    a->epoch += REBASE;
+    a->last -= REBASE;
+}
+
+/*******************************************************************************
+ * ARENA FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @brief Initialize embedded struct.
+ * @param a
+ * @param capacity - Expected number of timeouts; the arena grows past it.
+ * @param epoch - The current time.
+ */
+void
+hitime_arena_init(hitime_arena_t *a, uint32_t capacity, uint64_t epoch)
+{
+    if (capacity > NIL - HEADS - 1)
+    {
+        capacity = NIL - HEADS - 1;
+    }
+
+    a->epoch = epoch;
+    a->last = 0;
+    a->bitset = 0;
+    a->free = NIL;
+    a->len = HEADS;
+    a->cap = HEADS + (capacity ? capacity : 1);
+    a->nodes = hitime_rawalloc(a->cap * sizeof(hitime_anode_t));
+
+    uint32_t l;
+    for (l = 0; l < HEADS; ++l)
+    {
+        list_clear(a, l);
+    }
+}
+
+/**
+ * @brief Cleanup embedded struct; every handle becomes invalid.
+ */
+void
+hitime_arena_destroy(hitime_arena_t *a)
+{
+    hitime_rawfree(a->nodes);
+    (*a) = (const hitime_arena_t){ 0 };
+}
+
+/**
+ * @return Heap allocated arena manager.
+ */
+hitime_arena_t *
+hitime_arena_new(uint32_t capacity, uint64_t epoch)
+{
+    hitime_arena_t *a = hitime_rawalloc(sizeof(hitime_arena_t));
+    hitime_arena_init(a, capacity, epoch);
+    return a;
+}
+
+void
+hitime_arena_free(hitime_arena_t **a)
+{
+    hitime_arena_destroy(*a);
+    hitime_rawfree(*a);
+    *a = NULL;
+}
+
+/**
+ * @brief Get an unused timeout from the arena, growing it if needed.
+ * @return Handle of the timeout; HITIME_ARENA_NIL if the indices ran out.
+ * @warn Growing moves the arena; handles stay valid, node pointers do not.
+ */
+uint32_t
+hitime_arena_alloc(hitime_arena_t *a)
+{
+    uint32_t i = a->free;
+
+    if (NIL != i)
+    {
+        a->free = get_node(a, i)->prev;
+    }
+    else
+    {
+        if (UNLIKELY(a->len == a->cap))
+        {
+            if (a->cap == NIL)
+            {
+                return NIL;
+            }
+            uint32_t cap = a->cap > NIL / 2 ? NIL : a->cap * 2;
+            a->nodes = hitime_rawrealloc(a->nodes, cap * sizeof(hitime_anode_t));
+            a->cap = cap;
+        }
+        i = a->len++;
+    }
+
+    node_clear(a, i);
+    get_node(a, i)->when = 0;
+
+    return i;
+}
+
+/**
+ * @brief Stop the timeout and give it back to the arena.
+ */
+void
+hitime_arena_release(hitime_arena_t *a, uint32_t i)
+{
+    hitime_arena_stop(a, i);
+    get_node(a, i)->prev = a->free;
+    a->free = i;
+}
+
+/**
+ * @brief Start the timeout.
+ * @param a
+ * @param i - Handle of the timeout.
+ * @param when - Absolute time to expire at.
+ * @return False if the time is over 2**32 after the epoch; not started.
+ *
+ * Like hitime_start nothing happens if the timeout is already started.
+ * At least 2**31 past the last time is always in range.
+ */
+bool
+hitime_arena_start(hitime_arena_t *a, uint32_t i, uint64_t when)
+{
+    if (UNLIKELY(node_in_list(a, i)))
+    {
+        return true;
+    }
+
+    hitime_anode_t *n = get_node(a, i);
+    uint64_t last = a->epoch + a->last;
+    if (UNLIKELY(when <= last))
+    {
+        n->when = a->last;
+        list_nq(a, EXPIRED, i);
+    }
+    else
+    {
+        uint64_t relative = when - a->epoch;
+        if (UNLIKELY(relative > UINT32_MAX))
+        {
+            return false;
+        }
+        n->when = (uint32_t)relative;
+        ar_nq(a, i);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Stop the timeout; safe if not started.
+ */
+void
+hitime_arena_stop(hitime_arena_t *a, uint32_t i)
+{
+    if (LIKELY(node_in_list(a, i)))
+    {
+        ar_unlink_only(a, i);
+        node_clear(a, i);
+    }
+}
+
+/**
+ * @return The absolute time the timeout was started with; only meaningful
+ *         while it is started.
+ */
+uint64_t
+hitime_arena_when(hitime_arena_t *a, uint32_t i)
+{
+    return a->epoch + get_node(a, i)->when;
+}
+
+/**
+ * @return Time until the next bin triggers; max wait if empty.
+ */
+uint64_t
+hitime_arena_get_wait(hitime_arena_t *a)
+{
+    uint64_t wait = WAITMAX;
+
+    if (a->bitset)
+    {
+        int index = get_low_index32(a->bitset);
+        uint32_t mask = get_bit32(index) - 1;
+        wait = (uint64_t)(mask - (mask & a->last)) + 1;
+    }
+
+    return wait;
+}
+
+/**
+ * @brief Move any expired timeouts to the expired list.
+ * @param a
+ * @param now - The current time.
+ * @return False if nothing expired (or invalid 'now' given); true otherwise.
+ */
+bool
+hitime_arena_timeout(hitime_arena_t *a, uint64_t now)
+{
+    if (UNLIKELY(now <= a->epoch + a->last)) { return false; }
+
+    uint64_t relative = now - a->epoch;
+    if (UNLIKELY(relative > UINT32_MAX))
+    {
+        /* Every timeout is before the new time. */
+        ar_take_bins(a, EXPIRED, UINT32_MAX);
+        a->epoch = now;
+        a->last = 0;
+    }
+    else
+    {
+        ar_advance(a, (uint32_t)relative);
+        ar_process_all(a);
+
+        if (UNLIKELY(a->last & REBASE))
+        {
+            ar_rebase(a);
+        }
+    }
+
+    return !list_is_empty(a, EXPIRED);
+}
+
+/**
+ * @brief Take all timeouts and put into expired.
+ */
+void
+hitime_arena_expire_all(hitime_arena_t *a)
+{
+    ar_take_bins(a, EXPIRED, UINT32_MAX);
+}
+
+/**
+ * @return The next expired timeout; HITIME_ARENA_NIL if none.
+ */
+uint32_t
+hitime_arena_get_next(hitime_arena_t *a)
+{
+    return list_dq(a, EXPIRED);
+}
+
+uint64_t
+hitime_arena_get_last(hitime_arena_t *a)
+{
+    return a->epoch + a->last;
+}
+
+/**
+ * @return Octets used by the manager and its arena.
+ */
+size_t
+hitime_arena_footprint(hitime_arena_t *a)
+{
+    return sizeof(*a) + (size_t)a->cap * sizeof(hitime_anode_t);
+}
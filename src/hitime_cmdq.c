@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_cmdq.c
+ * @author Craig Jacobson
+ * @brief Lock-free command queue implementation.
+ *
+ * A bounded ring where every slot carries a sequence number, so producers
+ * only contend on the tail and never wait on each other or the consumer.
+ */
+
+#include "hitime_cmdq.h"
+#include "hitime_util.h"
+
+
+/*******************************************************************************
+ * HELPER FUNCTIONS
+*******************************************************************************/
+
+INLINE static size_t
+get_capacity(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+/**
+ * @return False if the queue is full.
+ */
+INLINE static bool
+cmdq_push(hitime_cmdq_t *q, int op, hitimeout_t *t, hitime_time_t when)
+{
+    hitime_slot_t *slot;
+    uint64_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    for (;;)
+    {
+        slot = q->slots + (pos & q->mask);
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (0 == diff)
+        {
+            /* Claim the slot; on failure pos is reloaded. */
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* The consumer has not freed the slot from the last lap. */
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->op = op;
+    slot->t = t;
+    slot->when = when;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+
+/*******************************************************************************
+ * COMMAND QUEUE FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @brief Initialize embedded struct.
+ * @param q
+ * @param capacity - Rounded up to a power of two.
+ */
+void
+hitime_cmdq_init(hitime_cmdq_t *q, size_t capacity)
+{
+    capacity = get_capacity(capacity);
+
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    q->mask = capacity - 1;
+    q->slots = hitime_rawalloc_aligned(HITIME_CACHE_LINE, capacity * sizeof(hitime_slot_t));
+
+    size_t i;
+    for (i = 0; i < capacity; ++i)
+    {
+        atomic_init(&q->slots[i].seq, i);
+    }
+}
+
+/**
+ * @brief Cleanup embedded struct; commands still queued are dropped.
+ */
+void
+hitime_cmdq_destroy(hitime_cmdq_t *q)
+{
+    hitime_rawfree(q->slots);
+    q->slots = NULL;
+    q->mask = 0;
+}
+
+/**
+ * @return Heap allocated command queue.
+ */
+hitime_cmdq_t *
+hitime_cmdq_new(size_t capacity)
+{
+    hitime_cmdq_t *q = hitime_rawalloc_aligned(HITIME_CACHE_LINE, sizeof(hitime_cmdq_t));
+    hitime_cmdq_init(q, capacity);
+    return q;
+}
+
+void
+hitime_cmdq_free(hitime_cmdq_t **q)
+{
+    hitime_cmdq_destroy(*q);
+    hitime_rawfree(*q);
+    *q = NULL;
+}
+
+/**
+ * @brief Post a start; any thread.
+ * @param q
+ * @param t - The timeout; must stay valid until the command is applied.
+ * @param when - The time to start the timeout with.
+ * @return False if the queue is full; nothing was posted.
+ *
+ * Like hitime_start nothing happens if the timeout is already started.
+ */
+bool
+hitime_cmdq_start(hitime_cmdq_t *q, hitimeout_t *t, hitime_time_t when)
+{
+    return cmdq_push(q, HITIME_CMD_START, t, when);
+}
+
+/**
+ * @brief Post a stop; any thread.
+ * @return False if the queue is full; nothing was posted.
+ * @warn The timeout may still expire before the stop is applied.
+ */
+bool
+hitime_cmdq_stop(hitime_cmdq_t *q, hitimeout_t *t)
+{
+    return cmdq_push(q, HITIME_CMD_STOP, t, 0);
+}
+
+/**
+ * @brief Post a touch; any thread.
+ * @return False if the queue is full; nothing was posted.
+ */
+bool
+hitime_cmdq_touch(hitime_cmdq_t *q, hitimeout_t *t, hitime_time_t when)
+{
+    return cmdq_push(q, HITIME_CMD_TOUCH, t, when);
+}
+
+/**
+ * @brief Take the oldest command; consumer only.
+ * @return False if the queue is empty.
+ */
+bool
+hitime_cmdq_pop(hitime_cmdq_t *q, int *op, hitimeout_t **t, hitime_time_t *when)
+{
+    uint64_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    hitime_slot_t *slot = q->slots + (pos & q->mask);
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if (seq != pos + 1)
+    {
+        return false;
+    }
+
+    *op = slot->op;
+    *t = slot->t;
+    *when = slot->when;
+
+    /* Hand the slot to the producers of the next lap. */
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+    atomic_store_explicit(&q->head, pos + 1, memory_order_relaxed);
+
+    return true;
+}
+
+/**
+ * @return The number of commands posted and not yet applied; approximate
+ *         when read from a producer.
+ */
+size_t
+hitime_cmdq_size(hitime_cmdq_t *q)
+{
+    uint64_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return tail > head ? (size_t)(tail - head) : 0;
+}
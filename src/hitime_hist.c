@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_hist.c
+ * @author Craig Jacobson
+ * @brief Log-linear histogram implementation.
+ */
+
+#include "hitime_hist.h"
+#include "hitime_util.h"
+
+
+/**
+ * @return The largest value of the bucket.
+ */
+INLINE static uint64_t
+bucket_upper(int index)
+{
+    if (index < HITIME_HIST_SUB)
+    {
+        return (uint64_t)index;
+    }
+
+    int shift = (index >> HITIME_HIST_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(HITIME_HIST_SUB + (index & (HITIME_HIST_SUB - 1))) << shift;
+    return low + ((((uint64_t)1) << shift) - 1);
+}
+
+void
+hitime_hist_reset(hitime_hist_t *hist)
+{
+    hitime_memzero(hist, sizeof(*hist));
+}
+
+/**
+ * @param hist
+ * @param q - Fraction of the values at or below the result, from 0 to 1.
+ * @return The upper bound of the bucket of the value, at most the max;
+ *         zero if nothing was recorded.
+ */
+uint64_t
+hitime_hist_percentile(const hitime_hist_t *hist, double q)
+{
+    if (!hist->count)
+    {
+        return 0;
+    }
+
+    /* Rank of the value, from one; rounded up so p100 is the max. */
+    double r = q * (double)hist->count;
+    uint64_t rank = (uint64_t)r;
+    if ((double)rank < r || !rank)
+    {
+        ++rank;
+    }
+    if (rank > hist->count)
+    {
+        rank = hist->count;
+    }
+
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < HITIME_HIST_BUCKETS; ++i)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+
+    uint64_t upper = bucket_upper(i);
+    return upper < hist->max ? upper : hist->max;
+}
+
+void
+hitime_hist_summarize(const hitime_hist_t *hist, hitime_summary_t *s)
+{
+    s->count = hist->count;
+    s->p50 = hitime_hist_percentile(hist, 0.5);
+    s->p99 = hitime_hist_percentile(hist, 0.99);
+    s->p999 = hitime_hist_percentile(hist, 0.999);
+    s->max = hist->max;
+}
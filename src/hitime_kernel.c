@@ -0,0 +1,232 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_kernel.c
+ * @author Craig Jacobson
+ * @brief Bin classification kernels.
+ *
+ * A kernel takes a block of times and finds the bin of each relative to the
+ * last time, or HITIME_BINS if the time has passed. The bin is the index of
+ * the highest bit of when ^ last. AVX-512 has a 64-bit leading zero count;
+ * AVX2 does not, so the highest bit is smeared down and the bits counted.
+ * The kernel is picked on first use from what the CPU supports.
+ */
+
+#include "hitime.h"
+#include "hitime_kernel.h"
+#include "hitime_util.h"
+
+#include <stdatomic.h>
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HITIME_X86 (1)
+#include <immintrin.h>
+#else
+#define HITIME_X86 (0)
+#endif
+
+
+typedef void (*classify_fn)(const uint64_t *, size_t, uint64_t, uint8_t *);
+
+static void
+classify_resolve(const uint64_t *, size_t, uint64_t, uint8_t *);
+
+static _Atomic(classify_fn) classify = classify_resolve;
+static _Atomic int selected = HITIME_KERNEL_AUTO;
+
+
+/*******************************************************************************
+ * KERNEL FUNCTIONS
+*******************************************************************************/
+
+static void
+classify_scalar(const uint64_t *when, size_t n, uint64_t last, uint8_t *index)
+{
+    size_t i;
+    for (i = 0; i < n; ++i)
+    {
+        index[i] = when[i] <= last ? HITIME_BINS : (uint8_t)get_high_index64(when[i] ^ last);
+    }
+}
+
+#if HITIME_X86
+__attribute__((target("avx2")))
+static void
+classify_avx2(const uint64_t *when, size_t n, uint64_t last, uint8_t *index)
+{
+    const __m256i vlast = _mm256_set1_epi64x((long long)last);
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i slast = _mm256_xor_si256(vlast, sign);
+    const __m256i bins = _mm256_set1_epi64x(HITIME_BINS);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    const __m256i counts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(when + i));
+        __m256i x = _mm256_xor_si256(w, vlast);
+
+        /* Smear the highest bit down; its index is then the count less one. */
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 1));
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 2));
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 4));
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 8));
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 16));
+        x = _mm256_or_si256(x, _mm256_srli_epi64(x, 32));
+
+        __m256i lo = _mm256_and_si256(x, low);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low);
+        __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(counts, lo), _mm256_shuffle_epi8(counts, hi));
+        c = _mm256_sad_epu8(c, _mm256_setzero_si256());
+        __m256i bin = _mm256_sub_epi64(c, one);
+
+        /* Unsigned when > last by flipping the sign bits. */
+        __m256i later = _mm256_cmpgt_epi64(_mm256_xor_si256(w, sign), slast);
+        bin = _mm256_blendv_epi8(bins, bin, later);
+
+        index[i] = (uint8_t)_mm256_extract_epi8(bin, 0);
+        index[i + 1] = (uint8_t)_mm256_extract_epi8(bin, 8);
+        index[i + 2] = (uint8_t)_mm256_extract_epi8(bin, 16);
+        index[i + 3] = (uint8_t)_mm256_extract_epi8(bin, 24);
+    }
+
+    classify_scalar(when + i, n - i, last, index + i);
+}
+
+__attribute__((target("avx512f,avx512cd")))
+static void
+classify_avx512(const uint64_t *when, size_t n, uint64_t last, uint8_t *index)
+{
+    const __m512i vlast = _mm512_set1_epi64((long long)last);
+    const __m512i bins = _mm512_set1_epi64(HITIME_BINS);
+    const __m512i top = _mm512_set1_epi64(63);
+    size_t i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        __mmask8 m = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        __m512i w = _mm512_maskz_loadu_epi64(m, when + i);
+        __m512i bin = _mm512_sub_epi64(top, _mm512_lzcnt_epi64(_mm512_xor_si512(w, vlast)));
+        __mmask8 later = _mm512_cmpgt_epu64_mask(w, vlast);
+        bin = _mm512_mask_blend_epi64(later, bins, bin);
+        _mm512_mask_cvtepi64_storeu_epi8(index + i, m, bin);
+    }
+}
+#endif
+
+/**
+ * @return The kernel, NULL if the CPU does not support it.
+ */
+static classify_fn
+get_kernel(int kernel)
+{
+    switch (kernel)
+    {
+        case HITIME_KERNEL_SCALAR:
+            return classify_scalar;
+#if HITIME_X86
+        case HITIME_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") ? classify_avx2 : NULL;
+        case HITIME_KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")
+                   ? classify_avx512 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+static void
+classify_resolve(const uint64_t *when, size_t n, uint64_t last, uint8_t *index)
+{
+    hitime_set_kernel(HITIME_KERNEL_AUTO);
+    atomic_load_explicit(&classify, memory_order_relaxed)(when, n, last, index);
+}
+
+
+/*******************************************************************************
+ * CLASSIFY FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @param when - The times.
+ * @param n - Length of the times.
+ * @param last - The last time of the manager.
+ * @param index - Filled with the bin of each time; HITIME_BINS if expired.
+ */
+void
+hitime_classify(const uint64_t *when, size_t n, uint64_t last, uint8_t *index)
+{
+    atomic_load_explicit(&classify, memory_order_relaxed)(when, n, last, index);
+}
+
+/**
+ * @brief Pick the kernel used to find the bins of timeouts when cascading.
+ * @param kernel - HITIME_KERNEL_AUTO picks the fastest the CPU supports.
+ * @return False if the CPU does not support the kernel; nothing changes.
+ *
+ * Applies to every manager. Safe to call from any thread at any time.
+ */
+bool
+hitime_set_kernel(int kernel)
+{
+    classify_fn fn = NULL;
+
+    if (HITIME_KERNEL_AUTO == kernel)
+    {
+        for (kernel = HITIME_KERNEL_AVX512; !fn; --kernel)
+        {
+            fn = get_kernel(kernel);
+        }
+        ++kernel;
+    }
+    else
+    {
+        fn = get_kernel(kernel);
+    }
+
+    if (!fn)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&classify, fn, memory_order_relaxed);
+    atomic_store_explicit(&selected, kernel, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @return The kernel in use.
+ */
+int
+hitime_get_kernel(void)
+{
+    if (HITIME_KERNEL_AUTO == atomic_load_explicit(&selected, memory_order_relaxed))
+    {
+        hitime_set_kernel(HITIME_KERNEL_AUTO);
+    }
+
+    return atomic_load_explicit(&selected, memory_order_relaxed);
+}
@@ -0,0 +1,476 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_pool.c
+ * @author Craig Jacobson
+ * @brief Slab allocator implementation.
+ *
+ * Free timeouts are linked through their data pointer. A thread's cache only
+ * belongs to one pool at a time and is handed back to that pool when the
+ * thread moves to another pool or exits. Live pools are kept in a list so a
+ * cache is only handed back to a pool that still exists; pools are told apart
+ * by a unique id, so a cache left over from a destroyed pool is dropped.
+ */
+
+#include "hitime_pool.h"
+#include "hitime_util.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define HITIME_POOL_LINE (64)
+#define HITIME_HUGE_PAGE (1024*1024 * 2)
+
+#ifndef HITIME_POOL_SLAB
+#define HITIME_POOL_SLAB (4096)
+#endif
+
+
+typedef struct
+{
+    void * mem;
+    size_t size;
+    bool   mapped;
+} slab_t;
+
+struct hitime_pool_s
+{
+    pthread_mutex_t lock;
+    uint64_t        id;
+    int             flags;
+    size_t          per_slab;//timeouts per slab
+    hitimeout_t *   free;//shared free list
+    hitimeout_t *   bump;//next timeout never handed out
+    hitimeout_t *   end;
+    slab_t *        slabs;
+    size_t          len;
+    size_t          cap;
+    hitime_pool_t * next;//next live pool
+};
+
+typedef struct
+{
+    hitime_pool_t * pool;//only valid while the pool with the id is live
+    uint64_t        id;
+    hitimeout_t *   head;
+    size_t          len;
+} cache_t;
+
+static _Atomic uint64_t next_id = 1;
+static _Thread_local cache_t cache = { NULL, 0, NULL, 0 };
+static hitime_pool_t *default_pool = NULL;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static hitime_pool_t *pools = NULL;//live pools
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+
+/*******************************************************************************
+ * HELPER FUNCTIONS
+*******************************************************************************/
+
+INLINE static hitimeout_t *
+get_link(hitimeout_t *t)
+{
+    return t->data;
+}
+
+INLINE static void
+set_link(hitimeout_t *t, hitimeout_t *next)
+{
+    t->data = next;
+}
+
+/**
+ * @brief Hand every timeout of the cache back to its pool, if still live,
+ *        and empty the cache.
+ */
+static void
+cache_return(cache_t *c)
+{
+    if (c->head)
+    {
+        pthread_mutex_lock(&pools_lock);
+        hitime_pool_t *p = pools;
+        while (p && !(p == c->pool && p->id == c->id))
+        {
+            p = p->next;
+        }
+        if (p)
+        {
+            hitimeout_t *last = c->head;
+            while (get_link(last))
+            {
+                last = get_link(last);
+            }
+            pthread_mutex_lock(&p->lock);
+            set_link(last, p->free);
+            p->free = c->head;
+            pthread_mutex_unlock(&p->lock);
+        }
+        pthread_mutex_unlock(&pools_lock);
+    }
+
+    c->pool = NULL;
+    c->id = 0;
+    c->head = NULL;
+    c->len = 0;
+}
+
+static void
+cache_destruct(void *c)
+{
+    cache_return(c);
+}
+
+static void
+cache_key_create(void)
+{
+    pthread_key_create(&cache_key, cache_destruct);
+}
+
+INLINE static cache_t *
+get_cache(hitime_pool_t *p)
+{
+    if (UNLIKELY(cache.id != p->id))
+    {
+        if (cache.id)
+        {
+            cache_return(&cache);
+        }
+        else
+        {
+            /* First use by this thread; return the cache when it exits. */
+            pthread_once(&cache_once, cache_key_create);
+            pthread_setspecific(cache_key, &cache);
+        }
+        cache.pool = p;
+        cache.id = p->id;
+    }
+
+    return &cache;
+}
+
+/**
+ * @brief Get the memory of a slab; huge pages are tried first if asked for.
+ */
+static void
+slab_alloc(hitime_pool_t *p, slab_t *s)
+{
+    s->size = p->per_slab * sizeof(hitimeout_t);
+    s->mapped = false;
+    s->mem = NULL;
+
+#ifdef __linux__
+    if (p->flags & HITIME_POOL_HUGE)
+    {
+        int prot = PROT_READ | PROT_WRITE;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        mem = mmap(NULL, s->size, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+        if (MAP_FAILED == mem)
+        {
+            /* No reserved huge pages; ask for transparent ones instead. */
+            mem = mmap(NULL, s->size, prot, flags, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (MAP_FAILED != mem)
+            {
+                madvise(mem, s->size, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (MAP_FAILED != mem)
+        {
+            s->mem = mem;
+            s->mapped = true;
+            return;
+        }
+    }
+#endif
+
+    s->mem = hitime_rawalloc_aligned(HITIME_POOL_LINE, s->size);
+}
+
+static void
+slab_free(slab_t *s)
+{
+#ifdef __linux__
+    if (s->mapped)
+    {
+        munmap(s->mem, s->size);
+        return;
+    }
+#endif
+    hitime_rawfree(s->mem);
+}
+
+/**
+ * @brief Add a slab to carve timeouts from; lock held.
+ */
+static void
+pool_grow(hitime_pool_t *p)
+{
+    if (p->len == p->cap)
+    {
+        p->cap = p->cap ? p->cap * 2 : 8;
+        p->slabs = hitime_rawrealloc(p->slabs, p->cap * sizeof(slab_t));
+    }
+
+    slab_t *s = p->slabs + p->len++;
+    slab_alloc(p, s);
+    p->bump = s->mem;
+    p->end = p->bump + p->per_slab;
+}
+
+/**
+ * @brief Fill the thread's cache with half of its capacity.
+ */
+static void
+pool_refill(hitime_pool_t *p, cache_t *c)
+{
+    size_t want = HITIME_POOL_CACHE / 2;
+
+    pthread_mutex_lock(&p->lock);
+
+    while (c->len < want && p->free)
+    {
+        hitimeout_t *t = p->free;
+        p->free = get_link(t);
+        set_link(t, c->head);
+        c->head = t;
+        ++c->len;
+    }
+
+    while (c->len < want)
+    {
+        if (p->bump == p->end)
+        {
+            pool_grow(p);
+        }
+        hitimeout_t *t = p->bump++;
+        set_link(t, c->head);
+        c->head = t;
+        ++c->len;
+    }
+
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * @brief Hand half of the thread's cache back to the pool.
+ */
+static void
+pool_flush(hitime_pool_t *p, cache_t *c)
+{
+    hitimeout_t *first = c->head;
+    hitimeout_t *last = first;
+    size_t count = 1;
+    while (count < HITIME_POOL_CACHE / 2)
+    {
+        last = get_link(last);
+        ++count;
+    }
+    c->head = get_link(last);
+    c->len -= count;
+
+    pthread_mutex_lock(&p->lock);
+    set_link(last, p->free);
+    p->free = first;
+    pthread_mutex_unlock(&p->lock);
+}
+
+
+/*******************************************************************************
+ * POOL FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @param count - Timeouts per slab; zero for the default.
+ * @param flags - HITIME_POOL_HUGE to round slabs up to huge pages and
+ *                back them with huge pages where the system allows.
+ * @return Heap allocated pool.
+ */
+hitime_pool_t *
+hitime_pool_new(size_t count, int flags)
+{
+    hitime_pool_t *p = hitime_rawalloc(sizeof(hitime_pool_t));
+    hitime_memzero(p, sizeof(hitime_pool_t));
+
+    pthread_mutex_init(&p->lock, NULL);
+    p->id = atomic_fetch_add(&next_id, 1);
+    p->flags = flags;
+
+    if (!count)
+    {
+        count = HITIME_POOL_SLAB;
+    }
+    if (count < HITIME_POOL_CACHE)
+    {
+        count = HITIME_POOL_CACHE;
+    }
+    if (flags & HITIME_POOL_HUGE)
+    {
+        size_t size = count * sizeof(hitimeout_t);
+        size = (size + HITIME_HUGE_PAGE - 1) & ~((size_t)HITIME_HUGE_PAGE - 1);
+        count = size / sizeof(hitimeout_t);
+    }
+    p->per_slab = count;
+
+    pthread_mutex_lock(&pools_lock);
+    p->next = pools;
+    pools = p;
+    pthread_mutex_unlock(&pools_lock);
+
+    return p;
+}
+
+/**
+ * @brief Free the pool and every timeout it handed out.
+ * @warn No thread may use the pool or its timeouts afterwards.
+ */
+void
+hitime_pool_free(hitime_pool_t **pool)
+{
+    hitime_pool_t *p = *pool;
+
+    pthread_mutex_lock(&pools_lock);
+    hitime_pool_t **link = &pools;
+    while (*link != p)
+    {
+        link = &(*link)->next;
+    }
+    *link = p->next;
+    pthread_mutex_unlock(&pools_lock);
+
+    if (cache.id == p->id)
+    {
+        /* The timeouts go with the slabs. */
+        cache.head = NULL;
+        cache_return(&cache);
+    }
+
+    size_t i;
+    for (i = 0; i < p->len; ++i)
+    {
+        slab_free(p->slabs + i);
+    }
+    hitime_rawfree(p->slabs);
+    pthread_mutex_destroy(&p->lock);
+    hitime_rawfree(p);
+    *pool = NULL;
+}
+
+/**
+ * @return An initialized timeout; any thread.
+ */
+hitimeout_t *
+hitime_pool_alloc(hitime_pool_t *p)
+{
+    cache_t *c = get_cache(p);
+
+    if (UNLIKELY(!c->head))
+    {
+        pool_refill(p, c);
+    }
+
+    hitimeout_t *t = c->head;
+    c->head = get_link(t);
+    --c->len;
+    hitimeout_init(t);
+
+    return t;
+}
+
+/**
+ * @brief Give the timeout back; any thread.
+ * @warn The timeout must be stopped and come from this pool.
+ */
+void
+hitime_pool_release(hitime_pool_t *p, hitimeout_t *t)
+{
+    cache_t *c = get_cache(p);
+
+    hitimeout_destroy(t);
+    set_link(t, c->head);
+    c->head = t;
+    ++c->len;
+
+    if (UNLIKELY(c->len > HITIME_POOL_CACHE))
+    {
+        pool_flush(p, c);
+    }
+}
+
+/**
+ * @brief Hand the calling thread's cached timeouts back to their pool.
+ *
+ * Done for a thread when it moves to another pool or exits; call it from
+ * a thread that stays alive but is done with the pool, or from the main
+ * thread before exit since thread exit handlers do not run for it.
+ */
+void
+hitime_pool_flush_thread(void)
+{
+    cache_return(&cache);
+}
+
+size_t
+hitime_pool_count_slabs(hitime_pool_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    size_t len = p->len;
+    pthread_mutex_unlock(&p->lock);
+    return len;
+}
+
+/**
+ * @return Timeouts per slab.
+ */
+size_t
+hitime_pool_slab_size(hitime_pool_t *p)
+{
+    return p->per_slab;
+}
+
+/**
+ * @brief Route hitimeout_new and hitimeout_free through the pool.
+ * @param p - The pool; NULL to use malloc again.
+ * @warn Not thread safe; set before timeouts are allocated and
+ *       free timeouts the same way they were allocated.
+ */
+void
+hitime_pool_set_default(hitime_pool_t *p)
+{
+    default_pool = p;
+}
+
+hitime_pool_t *
+hitime_pool_get_default(void)
+{
+    return default_pool;
+}
@@ -0,0 +1,345 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_radix.c
+ * @author Craig Jacobson
+ * @brief Radix timeout manager implementation.
+ *
+ * A timeout is placed at the level of the highest digit where its time
+ * differs from the last time, in the slot of its own digit there.
+ * When time advances, the highest changed level is the top: every level
+ * below it has passed, as have the slots of the top between the old and
+ * new digit. Only the slot of the new digit needs to be looked at again.
+ */
+
+#include "hitime_core.h"
+#include "hitime_radix.h"
+#include "hitime_util.h"
+
+
+static const hitime_time_t WAITMAX = (hitime_time_t)-1;
+
+
+/*******************************************************************************
+ * HELPER FUNCTIONS
+*******************************************************************************/
+
+INLINE static int
+get_digit(hitime_radix_t *r, hitime_time_t time, int level)
+{
+    return (int)((time >> (level * r->bits)) & (get_bit64(r->bits) - 1));
+}
+
+INLINE static hitime_node_t *
+get_slot(hitime_radix_t *r, int level, int digit)
+{
+    return r->slots + ((level << r->bits) | digit);
+}
+
+/*******************************************************************************
+ * RADIX FUNCTIONS
+*******************************************************************************/
+
+INLINE static void
+rx_nq(hitime_radix_t *r, hitimeout_t *t)
+{
+    if (UNLIKELY(t->when <= r->last))
+    {
+        list_nq(&r->expired, &t->node);
+        return;
+    }
+
+    int level = get_high_index64(t->when ^ r->last) / r->bits;
+    int digit = get_digit(r, t->when, level);
+    list_nq(get_slot(r, level, digit), &t->node);
+    r->occupied[level] |= get_bit64(digit);
+    r->levels_set |= get_bit64(level);
+}
+
+/**
+ * @brief Move the slots in the mask of the level to the list.
+ */
+INLINE static void
+rx_take_slots(hitime_radix_t *r, hitime_node_t *l, int level, uint64_t mask)
+{
+    uint64_t bits = r->occupied[level] & mask;
+    r->occupied[level] &= ~mask;
+    if (!r->occupied[level])
+    {
+        r->levels_set &= ~get_bit64(level);
+    }
+
+    while (bits)
+    {
+        list_append(l, get_slot(r, level, get_low_index64(bits)));
+        bits &= bits - 1;
+    }
+}
+
+/**
+ * @param bits - Each level has 2**bits slots; clamped to [1, HITIME_RADIX_MAX_BITS].
+ */
+void
+hitime_radix_init(hitime_radix_t *r, int bits)
+{
+    if (bits < 1)
+    {
+        bits = 1;
+    }
+    if (bits > HITIME_RADIX_MAX_BITS)
+    {
+        bits = HITIME_RADIX_MAX_BITS;
+    }
+
+    r->last = 0;
+    r->levels_set = 0;
+    r->moves = 0;
+    r->bits = bits;
+    r->levels = (HITIME_TIME_BITS + bits - 1) / bits;
+    r->occupied = hitime_rawalloc(r->levels * sizeof(uint64_t));
+    hitime_memzero(r->occupied, r->levels * sizeof(uint64_t));
+    r->slots = hitime_rawalloc((r->levels << bits) * sizeof(hitime_node_t));
+    list_clear(&r->expired);
+
+    int i;
+    for (i = 0; i < (r->levels << bits); ++i)
+    {
+        list_clear(r->slots + i);
+    }
+}
+
+/**
+ * @brief Cleanup embedded struct.
+ * @warn Stop or expire all timeouts first.
+ */
+void
+hitime_radix_destroy(hitime_radix_t *r)
+{
+    hitime_rawfree(r->occupied);
+    hitime_rawfree(r->slots);
+    (*r) = (const hitime_radix_t){ 0 };
+}
+
+/**
+ * @return Heap allocated radix manager.
+ */
+hitime_radix_t *
+hitime_radix_new(int bits)
+{
+    hitime_radix_t *r = hitime_rawalloc(sizeof(hitime_radix_t));
+    hitime_radix_init(r, bits);
+    return r;
+}
+
+void
+hitime_radix_free(hitime_radix_t **r)
+{
+    hitime_radix_destroy(*r);
+    hitime_rawfree(*r);
+    *r = NULL;
+}
+
+/**
+ * @brief Same as hitime_start.
+ */
+void
+hitime_radix_start(hitime_radix_t *r, hitimeout_t *t)
+{
+    if (UNLIKELY(t->node.next))
+    {
+        return;
+    }
+
+    rx_nq(r, t);
+}
+
+/**
+ * @brief Same as hitime_stop.
+ *
+ * The previous node is a list head iff the list is now empty;
+ * only then do we need to know which slot it was.
+ */
+void
+hitime_radix_stop(hitime_radix_t *r, hitimeout_t *t)
+{
+    hitime_node_t *n = &t->node;
+    if (UNLIKELY(!n->next))
+    {
+        return;
+    }
+
+    hitime_node_t *prev = n->prev;
+    n->next->prev = prev;
+    prev->next = n->next;
+    (*n) = (const hitime_node_t){ 0 };
+
+    if (!list_has(prev))
+    {
+        uintptr_t offset = (uintptr_t)prev - (uintptr_t)r->slots;
+        size_t index = offset / sizeof(*prev);
+        if (offset < ((size_t)r->levels << r->bits) * sizeof(*prev))
+        {
+            int level = (int)(index >> r->bits);
+            r->occupied[level] &= ~get_bit64((int)(index & (get_bit64(r->bits) - 1)));
+            if (!r->occupied[level])
+            {
+                r->levels_set &= ~get_bit64(level);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Same as hitime_touch.
+ */
+void
+hitime_radix_touch(hitime_radix_t *r, hitimeout_t *t, hitime_time_t when)
+{
+    hitime_radix_stop(r, t);
+    t->when = when;
+    rx_nq(r, t);
+}
+
+/**
+ * @return The time to wait until the earliest slot is due; max wait if none.
+ *
+ * The lowest level is due first, and within it the lowest slot.
+ */
+hitime_time_t
+hitime_radix_get_wait(hitime_radix_t *r)
+{
+    if (!r->levels_set)
+    {
+        return WAITMAX;
+    }
+
+    int level = get_low_index64(r->levels_set);
+    int digit = get_low_index64(r->occupied[level]);
+    int shift = level * r->bits;
+    int high = shift + r->bits;
+    uint64_t lower = high >= 64 ? UINT64_MAX : get_bit64(high) - 1;
+    hitime_time_t due = (hitime_time_t)((r->last & ~lower) | ((uint64_t)digit << shift));
+
+    return due - r->last;
+}
+
+/**
+ * @brief Same as hitime_timeout.
+ * @return False if nothing expired (or invalid 'now' given); true otherwise.
+ */
+bool
+hitime_radix_timeout(hitime_radix_t *r, hitime_time_t now)
+{
+    if (UNLIKELY(now <= r->last))
+    {
+        return false;
+    }
+
+    int top = get_high_index64(now ^ r->last) / r->bits;
+    int from = get_digit(r, r->last, top);
+    int to = get_digit(r, now, top);
+
+    /* Every level below the top has passed. */
+    uint64_t below = r->levels_set & (get_bit64(top) - 1);
+    while (below)
+    {
+        rx_take_slots(r, &r->expired, get_low_index64(below), UINT64_MAX);
+        below &= below - 1;
+    }
+
+    /* So have the slots of the top between the digits; the new one may not have. */
+    uint64_t passed = (get_bit64(to) - 1) & ~(get_bit64(from + 1) - 1);
+    rx_take_slots(r, &r->expired, top, passed);
+
+    hitime_node_t pending;
+    list_clear(&pending);
+    rx_take_slots(r, &pending, top, get_bit64(to));
+
+    r->last = now;
+
+    hitime_node_t *n;
+    while ((n = list_dq(&pending)))
+    {
+        hitimeout_t *t = to_timeout(n);
+        if (t->when > now)
+        {
+            ++r->moves;
+        }
+        rx_nq(r, t);
+    }
+
+    return list_has(&r->expired);
+}
+
+/**
+ * @brief Take all timers and put into expired.
+ */
+void
+hitime_radix_expire_all(hitime_radix_t *r)
+{
+    while (r->levels_set)
+    {
+        rx_take_slots(r, &r->expired, get_low_index64(r->levels_set), UINT64_MAX);
+    }
+}
+
+/**
+ * @return The next expired timeout; NULL if none.
+ */
+hitimeout_t *
+hitime_radix_get_next(hitime_radix_t *r)
+{
+    hitime_node_t *n = list_dq(&r->expired);
+    return n ? to_timeout(n) : NULL;
+}
+
+hitime_time_t
+hitime_radix_get_last(hitime_radix_t *r)
+{
+    return r->last;
+}
+
+/**
+ * @return The number of times a timeout was moved to a lower level.
+ */
+uint64_t
+hitime_radix_get_moves(hitime_radix_t *r)
+{
+    return r->moves;
+}
+
+/**
+ * @return The count of all timeouts in the manager, excluding expired.
+ */
+int
+hitime_radix_count_all(hitime_radix_t *r)
+{
+    int count = 0;
+
+    int i;
+    for (i = 0; i < (r->levels << r->bits); ++i)
+    {
+        count += list_count(r->slots + i);
+    }
+
+    return count;
+}
@@ -0,0 +1,332 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_sharded.c
+ * @author Craig Jacobson
+ * @brief Sharded timeout manager implementation.
+ *
+ * Builds on the single threaded core; the only shared state is the command
+ * queue of each shard and the deadline each owner publishes for get_wait.
+ */
+
+#include "hitime_sharded.h"
+#include "hitime_util.h"
+
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * HELPER FUNCTIONS
+*******************************************************************************/
+
+typedef struct
+{
+    hitime_sharded_t *hs;
+    int               index;
+} binding_t;
+
+static _Thread_local binding_t binding = { NULL, -1 };
+
+INLINE static hitime_shard_t *
+hs_get_shard(hitime_sharded_t *hs, int index)
+{
+    return hs->shards + index;
+}
+
+INLINE static bool
+hs_is_owner(hitime_sharded_t *hs, int index)
+{
+    return binding.hs == hs && binding.index == index;
+}
+
+/**
+ * @brief Spread timeout addresses over the shards.
+ */
+INLINE static int
+hs_hash(hitime_sharded_t *hs, hitimeout_t *t)
+{
+    uint64_t bits = (uint64_t)(uintptr_t)t;
+    bits *= UINT64_C(0x9E3779B97F4A7C15);
+    return (int)((bits >> 32) % (uint64_t)hs->count);
+}
+
+/**
+ * @brief Publish the owner's next deadline for other threads.
+ */
+INLINE static void
+hs_publish(hitime_shard_t *s)
+{
+    hitime_time_t deadline = hitime_get_deadline(&s->ht);
+    atomic_store_explicit(&s->deadline, deadline, memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * SHARDED FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @param count - The number of shards, usually one per thread.
+ * @param policy - How hitime_sharded_start/stop pick the shard.
+ * @return Heap allocated sharded manager.
+ */
+hitime_sharded_t *
+hitime_sharded_new(int count, hitime_policy_t policy)
+{
+    if (count < 1)
+    {
+        count = 1;
+    }
+
+    hitime_sharded_t *hs = hitime_rawalloc(sizeof(hitime_sharded_t));
+    hs->count = count;
+    hs->policy = policy;
+    hs->shards = hitime_rawalloc_aligned(HITIME_CACHE_LINE,
+                                         (size_t)count * sizeof(hitime_shard_t));
+
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        hitime_shard_t *s = hs_get_shard(hs, i);
+        hitime_init(&s->ht);
+        atomic_init(&s->deadline, hitime_max_wait());
+        hitime_cmdq_init(&s->cmdq, HITIME_SHARD_QUEUE);
+    }
+
+    return hs;
+}
+
+/**
+ * @brief Free the sharded manager.
+ * @warn All threads must be done with it and the shards must be emptied,
+ *       see hitime_destroy.
+ */
+void
+hitime_sharded_free(hitime_sharded_t **hs)
+{
+    int i;
+    for (i = 0; i < (*hs)->count; ++i)
+    {
+        hitime_shard_t *s = hs_get_shard(*hs, i);
+        hitime_destroy(&s->ht);
+        hitime_cmdq_destroy(&s->cmdq);
+    }
+
+    hitime_rawfree((*hs)->shards);
+    hitime_rawfree(*hs);
+    *hs = NULL;
+}
+
+/**
+ * @return The number of shards.
+ */
+int
+hitime_sharded_count(hitime_sharded_t *hs)
+{
+    return hs->count;
+}
+
+/**
+ * @brief Make the calling thread the owner of the shard.
+ * @param hs
+ * @param index - The shard; negative to unbind.
+ *
+ * A thread may be bound to one shard of one sharded manager at a time.
+ */
+void
+hitime_sharded_bind(hitime_sharded_t *hs, int index)
+{
+    if (index < 0 || index >= hs->count)
+    {
+        binding.hs = NULL;
+        binding.index = -1;
+    }
+    else
+    {
+        binding.hs = hs;
+        binding.index = index;
+    }
+}
+
+/**
+ * @return The shard the calling thread owns; negative if none.
+ */
+int
+hitime_sharded_bound(hitime_sharded_t *hs)
+{
+    return binding.hs == hs ? binding.index : -1;
+}
+
+/**
+ * @return The shard a start picks for the timeout according to the policy.
+ *
+ * With the thread policy this is the calling thread's shard,
+ * falling back on the hash for threads that own no shard.
+ */
+int
+hitime_sharded_select(hitime_sharded_t *hs, hitimeout_sharded_t *t)
+{
+    if (HITIME_SHARD_THREAD == hs->policy && binding.hs == hs)
+    {
+        return binding.index;
+    }
+
+    return hs_hash(hs, &t->t);
+}
+
+/**
+ * @return The manager of the shard; only the owner may use it.
+ */
+hitime_t *
+hitime_sharded_get(hitime_sharded_t *hs, int index)
+{
+    return &hs_get_shard(hs, index)->ht;
+}
+
+/**
+ * @brief Start the timeout on the shard picked by the policy.
+ * @return False if the command had to be posted and the queue was full.
+ *
+ * Started directly when the calling thread owns the shard, posted otherwise.
+ * Set the time before calling; the timeout must not be active.
+ */
+bool
+hitime_sharded_start(hitime_sharded_t *hs, hitimeout_sharded_t *t)
+{
+    int index = hitime_sharded_select(hs, t);
+
+    if (hs_is_owner(hs, index))
+    {
+        hitime_shard_t *s = hs_get_shard(hs, index);
+        t->shard = index;
+        hitime_start(&s->ht, &t->t);
+        hs_publish(s);
+        return true;
+    }
+
+    return hitime_sharded_post_start(hs, index, t);
+}
+
+/**
+ * @brief Stop the timeout on the shard it was started on.
+ * @return False if the command had to be posted and the queue was full.
+ *
+ * Stopped directly when the calling thread owns that shard, posted otherwise,
+ * whichever thread or policy started it.
+ */
+bool
+hitime_sharded_stop(hitime_sharded_t *hs, hitimeout_sharded_t *t)
+{
+    int index = t->shard;
+
+    if (hs_is_owner(hs, index))
+    {
+        hitime_shard_t *s = hs_get_shard(hs, index);
+        hitime_stop(&s->ht, &t->t);
+        hs_publish(s);
+        return true;
+    }
+
+    return hitime_sharded_post_stop(hs, t);
+}
+
+/**
+ * @brief Queue a start for the owner of the shard.
+ * @return False if the queue is full.
+ * @warn The timeout must stay valid and untouched until the owner applies it.
+ */
+bool
+hitime_sharded_post_start(hitime_sharded_t *hs, int index, hitimeout_sharded_t *t)
+{
+    t->shard = index;
+    return hitime_cmdq_start(&hs_get_shard(hs, index)->cmdq, &t->t, t->t.when);
+}
+
+/**
+ * @brief Queue a stop for the owner of the shard the timeout was started on.
+ * @return False if the queue is full.
+ * @warn The timeout may still expire before the owner applies the stop.
+ */
+bool
+hitime_sharded_post_stop(hitime_sharded_t *hs, hitimeout_sharded_t *t)
+{
+    return hitime_cmdq_stop(&hs_get_shard(hs, t->shard)->cmdq, &t->t);
+}
+
+/**
+ * @brief Apply posted commands then time out the shard; owner only.
+ * @return Same as hitime_timeout.
+ */
+bool
+hitime_sharded_timeout(hitime_sharded_t *hs, int index, hitime_time_t now)
+{
+    hitime_shard_t *s = hs_get_shard(hs, index);
+
+    hitime_apply_cmdq(&s->ht, &s->cmdq);
+    bool expired = hitime_timeout(&s->ht, now);
+    hs_publish(s);
+
+    return expired;
+}
+
+/**
+ * @return The next expired timeout of the shard; NULL if none. Owner only.
+ */
+hitimeout_sharded_t *
+hitime_sharded_get_next(hitime_sharded_t *hs, int index)
+{
+    hitimeout_t *t = hitime_get_next(&hs_get_shard(hs, index)->ht);
+    return t ? recover_ptr(t, hitimeout_sharded_t, t) : NULL;
+}
+
+/**
+ * @param hs
+ * @param now - The current time.
+ * @return The time to wait until any shard needs to time out.
+ *
+ * Safe to call from any thread; zero if any shard has posted commands.
+ */
+hitime_time_t
+hitime_sharded_get_wait(hitime_sharded_t *hs, hitime_time_t now)
+{
+    hitime_time_t deadline = hitime_max_wait();
+
+    int i;
+    for (i = 0; i < hs->count; ++i)
+    {
+        hitime_shard_t *s = hs_get_shard(hs, i);
+
+        if (hitime_cmdq_size(&s->cmdq))
+        {
+            return 0;
+        }
+
+        hitime_time_t d = atomic_load_explicit(&s->deadline, memory_order_relaxed);
+        deadline = d < deadline ? d : deadline;
+    }
+
+    if (deadline == hitime_max_wait())
+    {
+        return deadline;
+    }
+
+    return deadline > now ? deadline - now : 0;
+}
@@ -0,0 +1,316 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file hitime_trace.c
+ * @author Craig Jacobson
+ * @brief Trace recorder and reader.
+ *
+ * The file starts with a magic, a version, and the bits of the times.
+ * Each record is the op byte followed by varints: the zigzag delta of the
+ * timeout's address from the last address, in octets; the zigzag delta of
+ * the time from the manager's last time; and for partial timeouts the max.
+ * Ops without a timeout or time leave them out. The time of a base record
+ * is given as the delta from zero.
+ */
+
+#include "hitime_trace.h"
+#include "hitime_util.h"
+
+#include <stdio.h>
+
+#define TRACE_MAGIC "HITRACE"
+#define TRACE_VERSION (1)
+#define TRACE_BUF (1024*64)
+#define TRACE_REC_MAX (1 + 3 * 10)
+
+
+struct hitime_trace_s
+{
+    FILE *   f;
+    uint64_t key;//address of the last timeout
+    size_t   len;
+    uint8_t  buf[TRACE_BUF];
+};
+
+
+/*******************************************************************************
+ * ENCODING FUNCTIONS
+*******************************************************************************/
+
+INLINE static bool
+op_has_key(int op)
+{
+    return op <= HITIME_TRACE_TOUCH_LAZY || HITIME_TRACE_NEXT == op;
+}
+
+INLINE static bool
+op_has_time(int op)
+{
+    return (op <= HITIME_TRACE_PARTIAL && HITIME_TRACE_STOP != op) || HITIME_TRACE_BASE == op;
+}
+
+INLINE static uint64_t
+zigzag(uint64_t v)
+{
+    return (v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+INLINE static uint64_t
+unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ (uint64_t)-(int64_t)(v & 1);
+}
+
+INLINE static uint8_t *
+put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/**
+ * @return Past the varint; NULL if it runs past the end.
+ */
+INLINE static const uint8_t *
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t out = 0;
+    int shift = 0;
+    while (p < end && shift < 64)
+    {
+        uint8_t b = *p++;
+        out |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *v = out;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+static void
+trace_flush(hitime_trace_t *tr)
+{
+    if (tr->len)
+    {
+        fwrite(tr->buf, 1, tr->len, tr->f);
+        tr->len = 0;
+    }
+}
+
+
+/*******************************************************************************
+ * TRACE FUNCTIONS
+*******************************************************************************/
+
+/**
+ * @param path - File to write the trace to; truncated.
+ * @return New trace; NULL if the file could not be opened.
+ */
+hitime_trace_t *
+hitime_trace_open(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        return NULL;
+    }
+
+    hitime_trace_t *tr = hitime_rawalloc(sizeof(hitime_trace_t));
+    tr->f = f;
+    tr->key = 0;
+    tr->len = 0;
+
+    memcpy(tr->buf, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    tr->len = sizeof(TRACE_MAGIC);
+    tr->buf[tr->len++] = TRACE_VERSION;
+    tr->buf[tr->len++] = HITIME_TIME_BITS;
+    return tr;
+}
+
+/**
+ * @brief Write what is left and close the file.
+ *        Detach it from the manager first.
+ */
+void
+hitime_trace_close(hitime_trace_t **tr)
+{
+    if (*tr)
+    {
+        trace_flush(*tr);
+        fclose((*tr)->f);
+        hitime_rawfree(*tr);
+        *tr = NULL;
+    }
+}
+
+/**
+ * @brief Called by the manager; see HITIME_TRACE.
+ * @param tr
+ * @param op - One of HITIME_TRACE_*.
+ * @param t - The timeout, if the op has one.
+ * @param time - The time given, if the op has one.
+ * @param last - The last time of the manager; zero for a base record.
+ * @param arg - The max of a partial timeout.
+ */
+void
+hitime_trace_record(hitime_trace_t *tr, int op, const hitimeout_t *t,
+                    hitime_time_t time, hitime_time_t last, int64_t arg)
+{
+    if (UNLIKELY(tr->len + TRACE_REC_MAX > TRACE_BUF))
+    {
+        trace_flush(tr);
+    }
+
+    uint8_t *p = tr->buf + tr->len;
+    *p++ = (uint8_t)op;
+    if (op_has_key(op))
+    {
+        uint64_t key = (uint64_t)(uintptr_t)t;
+        p = put_varint(p, zigzag(key - tr->key));
+        tr->key = key;
+    }
+    if (op_has_time(op))
+    {
+        p = put_varint(p, zigzag((uint64_t)time - (uint64_t)last));
+    }
+    if (HITIME_TRACE_PARTIAL == op)
+    {
+        p = put_varint(p, zigzag((uint64_t)arg));
+    }
+    tr->len = (size_t)(p - tr->buf);
+}
+
+/**
+ * @param path - Trace file.
+ * @param len - Set to the number of records.
+ * @return The records, to be freed; NULL if the file is not a trace
+ *         with times of this width or it is cut short.
+ *
+ * The manager's last time is followed from the timeout records to make
+ * the times absolute again.
+ */
+hitime_trace_rec_t *
+hitime_trace_read(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+
+    size_t cap = TRACE_BUF;
+    size_t size = 0;
+    uint8_t *data = hitime_rawalloc(cap);
+    size_t n;
+    while ((n = fread(data + size, 1, cap - size, f)) > 0)
+    {
+        size += n;
+        if (size == cap)
+        {
+            cap *= 2;
+            data = hitime_rawrealloc(data, cap);
+        }
+    }
+    fclose(f);
+
+    const uint8_t *p = data + sizeof(TRACE_MAGIC) + 2;
+    const uint8_t *end = data + size;
+    if (size < sizeof(TRACE_MAGIC) + 2
+        || memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC))
+        || TRACE_VERSION != data[sizeof(TRACE_MAGIC)]
+        || HITIME_TIME_BITS != data[sizeof(TRACE_MAGIC) + 1])
+    {
+        hitime_rawfree(data);
+        return NULL;
+    }
+
+    /* Every record is at least an octet. */
+    hitime_trace_rec_t *recs = hitime_rawalloc((size_t)(end - p) * sizeof(*recs) + 1);
+    hitime_time_t last = 0;
+    uint64_t key = 0;
+    size_t count = 0;
+    while (p && p < end)
+    {
+        hitime_trace_rec_t *r = recs + count;
+        uint64_t v;
+        r->op = *p++;
+        r->key = 0;
+        r->time = 0;
+        r->arg = 0;
+        if (!r->op || r->op >= HITIME_TRACE_OPS)
+        {
+            p = NULL;
+            break;
+        }
+        if (op_has_key(r->op) && (p = get_varint(p, end, &v)))
+        {
+            key += unzigzag(v);
+            r->key = key;
+        }
+        if (p && op_has_time(r->op) && (p = get_varint(p, end, &v)))
+        {
+            uint64_t base = HITIME_TRACE_BASE == r->op ? 0 : (uint64_t)last;
+            r->time = (hitime_time_t)(base + unzigzag(v));
+        }
+        if (p && HITIME_TRACE_PARTIAL == r->op && (p = get_varint(p, end, &v)))
+        {
+            r->arg = (int64_t)unzigzag(v);
+        }
+        if (p && (HITIME_TRACE_TIMEOUT == r->op || HITIME_TRACE_PARTIAL == r->op) && r->time > last)
+        {
+            last = r->time;
+        }
+        else if (p && HITIME_TRACE_BASE == r->op)
+        {
+            last = r->time;
+        }
+        ++count;
+    }
+    hitime_rawfree(data);
+
+    if (!p)
+    {
+        hitime_rawfree(recs);
+        return NULL;
+    }
+    *len = count;
+    return recs;
+}
+
+const char *
+hitime_trace_op_name(int op)
+{
+    static const char *names[] =
+    {
+        "none", "start", "stop", "touch", "touch_lazy",
+        "timeout", "partial", "expire_all", "next", "take", "base",
+    };
+    return op > 0 && op < HITIME_TRACE_OPS ? names[op] : "none";
+}
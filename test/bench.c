@@ -0,0 +1,753 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file bench.c
+ * @author Craig Jacobson
+ * @brief The same workloads through hitime and the reference designs.
+ *
+ * Each workload is a seeded run of starts, stops, and touches while the time
+ * advances one tick at a time, so every design sees the same calls:
+ * - rto: retransmit timers, nearly all stopped and restarted before firing
+ * - idle: idle sessions, nearly all touched before firing
+ * - ttl: cache entries, nearly all expiring and inserted again
+ * - mixed: a bit of everything at random
+ *
+ * Every run is forked so its peak RSS is its own. One start, stop, or touch
+ * in SAMPLE is timed on its own with the serialized timestamps of cycles.h,
+ * the rest run untimed so the timestamps barely weigh on the totals and the
+ * counters. Each advance of the time, expiries and all, is timed whole.
+ * Prints CSV: design, workload, operations, seconds, operations per second,
+ * ns per start, stop, or touch at p50, p99, p999, and max, ns per advance at
+ * p50, p99, and max, expiries, checksum of the expiries, peak RSS in KiB, and
+ * per operation the cycles, instructions, L1d, LLC, branch, and dTLB misses
+ * over the ticks; see perfctr.h. Counters that are unavailable are left empty.
+ * The expiries must match across designs or it fails.
+ */
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cycles.h"
+#include "hitime.h"
+#include "hitime_hist.h"
+#include "perfctr.h"
+#include "reference.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*256)
+#endif
+
+#ifndef TICKS
+#define TICKS (2048)
+#endif
+
+/* Operations per tick, besides expiries. */
+#ifndef OPS
+#define OPS (MAXLEN / 64)
+#endif
+
+/* One operation in this many is timed on its own. */
+#ifndef SAMPLE
+#define SAMPLE (16)
+#endif
+
+
+typedef struct run_s run_t;
+
+/* Design
+ * A timer design behind the same calls. Timers are an array of size octets
+ * each, so a timer's id is its index. Start is only given idle timers.
+ */
+typedef struct
+{
+    const char *name;
+    size_t      size;
+    void *      (*create)(void);
+    void        (*destroy)(void *);
+    void        (*init)(void *);
+    void        (*start)(void *, void *, uint64_t);
+    void        (*stop)(void *, void *);
+    void        (*touch)(void *, void *, uint64_t);
+    void        (*advance)(void *, uint64_t, run_t *);
+} design_t;
+
+/* Workload */
+typedef struct
+{
+    const char *name;
+    void        (*setup)(run_t *);
+    void        (*tick)(run_t *);
+    void        (*expired)(run_t *, size_t);
+} workload_t;
+
+struct run_s
+{
+    const design_t *   d;
+    const workload_t * w;
+    void *             m;
+    char *             timers;
+    uint64_t           now;
+    uint64_t           rng;
+    uint64_t           ops;
+    uint64_t           expired;
+    uint64_t           sum;//order-free checksum of the expiries
+    hitime_hist_t *    hist;//ticks of the sampled operations
+};
+
+/* Sent from the run to the parent. */
+typedef struct
+{
+    uint64_t         ops;
+    double           seconds;
+    uint64_t         expired;
+    uint64_t         sum;
+    hitime_summary_t ps;//ticks per sampled start, stop, or touch
+    hitime_summary_t advance;//ticks per advance
+    double           counters[PERFCTR_COUNT];//over the ticks; negative if unavailable
+} result_t;
+
+
+/*******************************************************************************
+ * RUN FUNCTIONS
+*******************************************************************************/
+
+static inline uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @return Pseudo-random number of the time and id; the same whatever
+ *         order the expiries come in.
+ */
+static inline uint64_t
+hash(run_t *r, size_t id)
+{
+    return mix(((uint64_t)id << 32) ^ r->now);
+}
+
+static inline size_t
+pick(run_t *r)
+{
+    r->rng ^= r->rng << 13;
+    r->rng ^= r->rng >> 7;
+    r->rng ^= r->rng << 17;
+    return (size_t)(r->rng % MAXLEN);
+}
+
+static inline void *
+timer(run_t *r, size_t id)
+{
+    return r->timers + id * r->d->size;
+}
+
+/* Count the operation, timing it if it is the one in SAMPLE. */
+#define RUN_OP(r, call) \
+    do { \
+        if ((r)->ops++ % SAMPLE) \
+        { \
+            call; \
+        } \
+        else \
+        { \
+            uint64_t _start = cycles_start(); \
+            call; \
+            hitime_hist_record((r)->hist, cycles_stop() - _start); \
+        } \
+    } while (0)
+
+static inline void
+run_start(run_t *r, size_t id, uint64_t when)
+{
+    RUN_OP(r, r->d->start(r->m, timer(r, id), when));
+}
+
+static inline void
+run_stop(run_t *r, size_t id)
+{
+    RUN_OP(r, r->d->stop(r->m, timer(r, id)));
+}
+
+static inline void
+run_touch(run_t *r, size_t id, uint64_t when)
+{
+    RUN_OP(r, r->d->touch(r->m, timer(r, id), when));
+}
+
+static void
+run_expired(run_t *r, void *t)
+{
+    size_t id = (size_t)((char *)t - r->timers) / r->d->size;
+    ++r->expired;
+    ++r->ops;
+    r->sum += hash(r, id);
+    r->w->expired(r, id);
+}
+
+
+/*******************************************************************************
+ * DESIGNS
+*******************************************************************************/
+
+static void *
+ht_create(void)
+{
+    return hitime_new();
+}
+
+static void
+ht_destroy(void *m)
+{
+    hitime_expire_all(m);
+    while (hitime_get_next(m)) {}
+    hitime_t *h = m;
+    hitime_free(&h);
+}
+
+static void
+ht_init(void *t)
+{
+    hitimeout_init(t);
+}
+
+static void
+ht_start(void *m, void *t, uint64_t when)
+{
+    hitimeout_t *to = t;
+    to->when = when;
+    hitime_start(m, to);
+}
+
+static void
+ht_stop(void *m, void *t)
+{
+    hitime_stop(m, t);
+}
+
+static void
+ht_touch(void *m, void *t, uint64_t when)
+{
+    hitime_touch(m, t, when);
+}
+
+static void
+ht_advance(void *m, uint64_t now, run_t *r)
+{
+    hitime_timeout(m, now);
+    hitimeout_t *t;
+    while ((t = hitime_get_next(m)))
+    {
+        run_expired(r, t);
+    }
+}
+
+static void
+ref_expired(ref_timer_t *t, void *r)
+{
+    run_expired(r, t);
+}
+
+static void
+ref_init(void *t)
+{
+    ref_timer_init(t);
+}
+
+static void *
+heap_create(void)
+{
+    ref_heap_t *h = malloc(sizeof(*h));
+    ref_heap_init(h);
+    return h;
+}
+
+static void
+heap_destroy(void *m)
+{
+    ref_heap_destroy(m);
+    free(m);
+}
+
+static void
+heap_start(void *m, void *t, uint64_t when)
+{
+    ((ref_timer_t *)t)->when = when;
+    ref_heap_start(m, t);
+}
+
+static void
+heap_stop(void *m, void *t)
+{
+    ref_heap_stop(m, t);
+}
+
+static void
+heap_touch(void *m, void *t, uint64_t when)
+{
+    ref_heap_touch(m, t, when);
+}
+
+static void
+heap_advance(void *m, uint64_t now, run_t *r)
+{
+    ref_heap_expire(m, now, ref_expired, r);
+}
+
+static void *
+hash_create(void)
+{
+    ref_hash_t *w = malloc(sizeof(*w));
+    ref_hash_init(w);
+    return w;
+}
+
+static void
+hash_start(void *m, void *t, uint64_t when)
+{
+    ((ref_timer_t *)t)->when = when;
+    ref_hash_start(m, t);
+}
+
+static void
+hash_stop(void *m, void *t)
+{
+    ref_hash_stop(m, t);
+}
+
+static void
+hash_touch(void *m, void *t, uint64_t when)
+{
+    ref_hash_touch(m, t, when);
+}
+
+static void
+hash_advance(void *m, uint64_t now, run_t *r)
+{
+    ref_hash_expire(m, now, ref_expired, r);
+}
+
+static void *
+wheel_create(void)
+{
+    ref_wheel_t *w = malloc(sizeof(*w));
+    ref_wheel_init(w);
+    return w;
+}
+
+static void
+wheel_start(void *m, void *t, uint64_t when)
+{
+    ((ref_timer_t *)t)->when = when;
+    ref_wheel_start(m, t);
+}
+
+static void
+wheel_stop(void *m, void *t)
+{
+    ref_wheel_stop(m, t);
+}
+
+static void
+wheel_touch(void *m, void *t, uint64_t when)
+{
+    ref_wheel_touch(m, t, when);
+}
+
+static void
+wheel_advance(void *m, uint64_t now, run_t *r)
+{
+    ref_wheel_expire(m, now, ref_expired, r);
+}
+
+static const design_t designs[] =
+{
+    { "hitime", sizeof(hitimeout_t), ht_create, ht_destroy, ht_init,
+      ht_start, ht_stop, ht_touch, ht_advance },
+    { "heap", sizeof(ref_timer_t), heap_create, heap_destroy, ref_init,
+      heap_start, heap_stop, heap_touch, heap_advance },
+    { "hashed_wheel", sizeof(ref_timer_t), hash_create, free, ref_init,
+      hash_start, hash_stop, hash_touch, hash_advance },
+    { "hierarchical_wheel", sizeof(ref_timer_t), wheel_create, free, ref_init,
+      wheel_start, wheel_stop, wheel_touch, wheel_advance },
+};
+
+
+/*******************************************************************************
+ * WORKLOADS
+*******************************************************************************/
+
+static uint64_t
+rto(run_t *r, size_t id)
+{
+    return 200 + hash(r, id) % 100;
+}
+
+static void
+rto_setup(run_t *r)
+{
+    size_t id;
+    for (id = 0; id < MAXLEN; ++id)
+    {
+        run_start(r, id, r->now + rto(r, id));
+    }
+}
+
+/* Acknowledged; stop and arm for the next segment. */
+static void
+rto_tick(run_t *r)
+{
+    int i;
+    for (i = 0; i < OPS; ++i)
+    {
+        size_t id = pick(r);
+        run_stop(r, id);
+        run_start(r, id, r->now + rto(r, id));
+    }
+}
+
+/* Retransmit with backoff. */
+static void
+rto_expired(run_t *r, size_t id)
+{
+    run_start(r, id, r->now + 2 * rto(r, id));
+}
+
+static uint64_t
+idle(run_t *r, size_t id)
+{
+    return 256 + hash(r, id) % 256;
+}
+
+static void
+idle_setup(run_t *r)
+{
+    size_t id;
+    for (id = 0; id < MAXLEN; ++id)
+    {
+        run_start(r, id, r->now + idle(r, id));
+    }
+}
+
+static void
+idle_tick(run_t *r)
+{
+    int i;
+    for (i = 0; i < OPS; ++i)
+    {
+        size_t id = pick(r);
+        run_touch(r, id, r->now + idle(r, id));
+    }
+}
+
+/* Closed and replaced by a new session. */
+static void
+idle_expired(run_t *r, size_t id)
+{
+    run_start(r, id, r->now + idle(r, id));
+}
+
+static uint64_t
+ttl(run_t *r, size_t id)
+{
+    return 1 + hash(r, id) % 1024;
+}
+
+static void
+ttl_setup(run_t *r)
+{
+    size_t id;
+    for (id = 0; id < MAXLEN; ++id)
+    {
+        run_start(r, id, r->now + ttl(r, id));
+    }
+}
+
+/* A few entries are invalidated and fetched again. */
+static void
+ttl_tick(run_t *r)
+{
+    int i;
+    for (i = 0; i < OPS / 64; ++i)
+    {
+        size_t id = pick(r);
+        run_stop(r, id);
+        run_start(r, id, r->now + ttl(r, id));
+    }
+}
+
+static void
+ttl_expired(run_t *r, size_t id)
+{
+    run_start(r, id, r->now + ttl(r, id));
+}
+
+static void
+mixed_setup(run_t *r)
+{
+    size_t id;
+    for (id = 0; id < MAXLEN; id += 2)
+    {
+        run_start(r, id, r->now + 1 + hash(r, id) % 4096);
+    }
+}
+
+static void
+mixed_tick(run_t *r)
+{
+    int i;
+    for (i = 0; i < OPS; ++i)
+    {
+        size_t id = pick(r);
+        uint64_t h = hash(r, id);
+        switch (r->rng >> 62)
+        {
+            case 0:
+                run_stop(r, id);
+                run_start(r, id, r->now + 1 + h % 4096);
+                break;
+            case 1:
+                run_stop(r, id);
+                break;
+            case 2:
+                run_touch(r, id, r->now + 1 + h % 256);
+                break;
+            default:
+                run_touch(r, id, r->now + 1000 + h % 1000);
+                break;
+        }
+    }
+}
+
+static void
+mixed_expired(run_t *r, size_t id)
+{
+    (void)r;
+    (void)id;
+}
+
+static const workload_t workloads[] =
+{
+    { "rto", rto_setup, rto_tick, rto_expired },
+    { "idle", idle_setup, idle_tick, idle_expired },
+    { "ttl", ttl_setup, ttl_tick, ttl_expired },
+    { "mixed", mixed_setup, mixed_tick, mixed_expired },
+};
+
+
+/*******************************************************************************
+ * MAIN
+*******************************************************************************/
+
+static void
+run(const design_t *d, const workload_t *w, int seed, result_t *res)
+{
+    run_t r = { 0 };
+    r.d = d;
+    r.w = w;
+    r.m = d->create();
+    r.timers = malloc(MAXLEN * d->size);
+    r.rng = (uint64_t)seed * 0x9e3779b97f4a7c15ULL | 1;
+
+    hitime_hist_t hist;
+    hitime_hist_t advance;
+    r.hist = &hist;
+
+    size_t id;
+    for (id = 0; id < MAXLEN; ++id)
+    {
+        d->init(timer(&r, id));
+    }
+    w->setup(&r);
+
+    hitime_hist_reset(&hist);
+    hitime_hist_reset(&advance);
+    stopwatch_t sw;
+    double seconds = 0;
+    uint64_t ops = 0;
+    perfctr_t pc;
+    perfctr_open(&pc);
+    perfctr_start(&pc);
+    int i;
+    for (i = 0; i < TICKS; ++i)
+    {
+        r.ops = 0;
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        w->tick(&r);
+        ++r.now;
+        uint64_t start = cycles_start();
+        d->advance(r.m, r.now, &r);
+        hitime_hist_record(&advance, cycles_stop() - start);
+        stopwatch_stop(&sw);
+
+        seconds += stopwatch_elapsed(&sw);
+        ops += r.ops;
+    }
+    perfctr_stop(&pc);
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        res->counters[i] = perfctr_has(&pc, i) ? pc.value[i] : -1;
+    }
+    perfctr_close(&pc);
+
+    res->ops = ops;
+    res->seconds = seconds;
+    res->expired = r.expired;
+    res->sum = r.sum;
+    hitime_hist_summarize(&hist, &res->ps);
+    hitime_hist_summarize(&advance, &res->advance);
+
+    d->destroy(r.m);
+    free(r.timers);
+}
+
+/**
+ * @brief Run in a child so the peak RSS is of that run alone.
+ * @return False if the run failed.
+ */
+static bool
+run_forked(const design_t *d, const workload_t *w, int seed, result_t *res, long *rss)
+{
+    int fds[2];
+    if (pipe(fds))
+    {
+        perror("pipe");
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return false;
+    }
+    if (!pid)
+    {
+        close(fds[0]);
+        result_t out;
+        run(d, w, seed, &out);
+        ssize_t n = write(fds[1], &out, sizeof(out));
+        _exit(sizeof(out) == n ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        return false;
+    }
+    *rss = ru.ru_maxrss;
+    return sizeof(*res) == n;
+}
+
+int
+main(void)
+{
+    int seed = get_seed(FORCESEED);
+    int status = 0;
+
+    perfctr_t probe;
+    if (!perfctr_open(&probe))
+    {
+        fprintf(stderr, "Counters: unavailable (%s)\n", perfctr_why(&probe));
+    }
+    perfctr_close(&probe);
+
+    double per_ns = cycles_per_ns(100);
+    printf("design,workload,ops,seconds,ops_per_sec,ns_p50,ns_p99,ns_p999,ns_max,"
+           "advance_ns_p50,advance_ns_p99,advance_ns_max,expired,checksum,rss_kib,cycles_per_op,insns_per_op,l1d_miss_per_op,"
+           "llc_miss_per_op,branch_miss_per_op,dtlb_miss_per_op\n");
+
+    size_t wi, di;
+    for (wi = 0; wi < sizeof(workloads) / sizeof(workloads[0]); ++wi)
+    {
+        result_t first = { 0 };
+        for (di = 0; di < sizeof(designs) / sizeof(designs[0]); ++di)
+        {
+            result_t res;
+            long rss = 0;
+            if (!run_forked(designs + di, workloads + wi, seed, &res, &rss))
+            {
+                fprintf(stderr, "%s %s: run failed\n", designs[di].name, workloads[wi].name);
+                status = 1;
+                continue;
+            }
+
+            printf("%s,%s,%" PRIu64 ",%f,%f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%" PRIu64 ",%016" PRIx64 ",%ld",
+                   designs[di].name, workloads[wi].name, res.ops, res.seconds,
+                   (double)res.ops / res.seconds,
+                   (double)res.ps.p50 / per_ns, (double)res.ps.p99 / per_ns,
+                   (double)res.ps.p999 / per_ns, (double)res.ps.max / per_ns,
+                   (double)res.advance.p50 / per_ns, (double)res.advance.p99 / per_ns,
+                   (double)res.advance.max / per_ns,
+                   res.expired, res.sum, rss);
+            int ci;
+            for (ci = 0; ci < PERFCTR_COUNT; ++ci)
+            {
+                if (res.counters[ci] >= 0 && res.ops)
+                {
+                    printf(",%.4f", res.counters[ci] / (double)res.ops);
+                }
+                else
+                {
+                    printf(",");
+                }
+            }
+            printf("\n");
+
+            if (!di)
+            {
+                first = res;
+            }
+            else if (res.expired != first.expired || res.sum != first.sum)
+            {
+                fprintf(stderr, "%s %s: expiries differ from %s\n",
+                        designs[di].name, workloads[wi].name, designs[0].name);
+                status = 1;
+            }
+        }
+    }
+
+    return status;
+}
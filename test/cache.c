@@ -23,6 +23,8 @@
  * @file cache.c
  * @author Craig Jacobson
  * @brief Quick and dirty performance check using a more cache friendly method.
+ *
+ * Start and stop are timed through the library and through hitime_inline.h.
  */
 #include <assert.h>
 #include <errno.h>
@@ -33,6 +35,8 @@
 #include <time.h>
 
 #include "hitime.h"
+#include "hitime_inline.h"
+#include "perfctr.h"
 
 #ifndef FORCESEED
 #define FORCESEED (0)
@@ -109,6 +113,12 @@ main(void)
     printf("Seed: %d\n", seed);
     srand(seed);
 
+    perfctr_t pc;
+    if (!perfctr_open(&pc))
+    {
+        printf("Counters: unavailable (%s)\n", perfctr_why(&pc));
+    }
+
     stopwatch_reset(&sw);
 
     hitime_t ht;
@@ -122,6 +132,7 @@ main(void)
 
     // Time starts
     stopwatch_start(&sw);
+    perfctr_start(&pc);
 
     // Do the test
     int iter;
@@ -132,6 +143,7 @@ main(void)
     }
 
     // Time stops
+    perfctr_stop(&pc);
     stopwatch_stop(&sw);
 
     // Print stats
@@ -140,11 +152,61 @@ main(void)
     printf("Seconds: %f\n", seconds);
     double ops_per_second = ((double)maxiter) / seconds;
     printf("Start then stop ops/second: %f\n", ops_per_second);
+    perfctr_print(&pc, maxiter);
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    perfctr_start(&pc);
+
+    for (iter = 0; iter < maxiter; ++iter)
+    {
+        hitime_start_inline(&ht, t);
+        hitime_stop_inline(&ht, t);
+    }
+
+    perfctr_stop(&pc);
+    stopwatch_stop(&sw);
+
+    printf("INLINE START/STOP STATS\n");
+    seconds = stopwatch_elapsed(&sw);
+    printf("Seconds: %f\n", seconds);
+    ops_per_second = ((double)maxiter) / seconds;
+    printf("Start then stop ops/second: %f\n", ops_per_second);
+    perfctr_print(&pc, maxiter);
+
+    // Worst case for finding the wait is a lone timeout in the top bin
+    hitimeout_set(t, hitime_max_wait(), NULL);
+    hitime_start(&ht, t);
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    perfctr_start(&pc);
+
+    volatile uint64_t wait = 0;
+    for (iter = 0; iter < maxiter; ++iter)
+    {
+        wait = hitime_get_wait(&ht);
+    }
+    (void)wait;
+
+    perfctr_stop(&pc);
+    stopwatch_stop(&sw);
+    hitime_stop(&ht, t);
+
+    // Print stats
+    printf("WAIT STATS\n");
+    seconds = stopwatch_elapsed(&sw);
+    printf("Seconds: %f\n", seconds);
+    ops_per_second = ((double)maxiter) / seconds;
+    printf("Wait ops/second: %f\n", ops_per_second);
+    perfctr_print(&pc, maxiter);
 
     // Destroy data
     hitimeout_destroy(t);
     free(t);
 
+    perfctr_close(&pc);
+
     return 0;
 }
 
@@ -0,0 +1,168 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file cascade.c
+ * @author Craig Jacobson
+ * @brief Cascade large bins of timeouts scattered across the heap.
+ *
+ * Timeouts are allocated one at a time alongside other allocations and
+ * started in a random order, all in the same high bin. The first timeout
+ * cascades the whole bin; following the wait then cascades the lower bins
+ * until everything expires. Built once per bin layout and run once per
+ * kernel the CPU supports. Built with HITIME_PHASES the time of each phase
+ * of hitime_timeout is printed too.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hitime.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*1024 * 2)
+#endif
+
+#ifndef HIGHBIN
+#define HIGHBIN (24)
+#endif
+
+
+static void
+print_stats(const char *name, double seconds)
+{
+    printf("%s\n", name);
+    printf("Seconds: %f\n", seconds);
+    printf("Ops/second: %f\n", (double)MAXLEN / seconds);
+}
+
+static void
+print_phases(hitime_t *ht)
+{
+#if HITIME_PHASES
+    const char *names[] = { "EXPIRE FIRST", "EXPIRE BULK", "PROCESS SETUP", "PROCESS ALL" };
+    hitime_summary_t s[HITIME_PHASE_COUNT];
+    int bins[HITIME_PHASE_COUNT];
+    hitime_get_phases(ht, s, bins);
+
+    int i;
+    for (i = 0; i < HITIME_PHASE_COUNT; ++i)
+    {
+        printf("%s: calls %lu, p50 %lu, p99 %lu, p999 %lu, max %lu (bin %d)\n", names[i],
+               s[i].count, s[i].p50, s[i].p99, s[i].p999, s[i].max, bins[i]);
+    }
+#else
+    (void)ht;
+#endif
+}
+
+static void
+run(const char *name, int seed)
+{
+    stopwatch_t sw;
+    hitime_t ht;
+    int i;
+
+    srand(seed);
+    hitime_init(&ht);
+
+    printf("%s %s\n", HITIME_CHUNKED_BINS ? "CHUNKED BINS" : "LIST BINS", name);
+
+    hitimeout_t **tos = malloc(MAXLEN * sizeof(hitimeout_t *));
+    void **others = malloc(MAXLEN * sizeof(void *));
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        tos[i] = hitimeout_new();
+        // The rest of the application allocates too
+        others[i] = malloc(16 + (random() & 0xFF));
+    }
+
+    // Shuffle so neighbors in a bin are not neighbors in memory
+    for (i = MAXLEN - 1; i > 0; --i)
+    {
+        int j = (int)(random() % (i + 1));
+        hitimeout_t *tmp = tos[i];
+        tos[i] = tos[j];
+        tos[j] = tmp;
+    }
+
+    uint64_t base = ((uint64_t)1) << HIGHBIN;
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_set(tos[i], base + (random() & (base - 1)), NULL);
+        hitime_start(&ht, tos[i]);
+    }
+    assert(MAXLEN == hitime_count_bin(&ht, HIGHBIN));
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    hitime_timeout(&ht, base);
+    stopwatch_stop(&sw);
+    print_stats("CASCADE STATS", stopwatch_elapsed(&sw));
+
+    int count = 0;
+    uint64_t wait;
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    while ((wait = hitime_get_wait(&ht)) < hitime_max_wait())
+    {
+        hitime_timeout_elapse(&ht, wait);
+        while (hitime_get_next(&ht)) { ++count; }
+    }
+    while (hitime_get_next(&ht)) { ++count; }
+    stopwatch_stop(&sw);
+    assert(MAXLEN == count);
+    print_stats("EXPIRE STATS", stopwatch_elapsed(&sw));
+    print_phases(&ht);
+
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_free(tos + i);
+        free(others[i]);
+    }
+    free(others);
+    free(tos);
+    hitime_destroy(&ht);
+}
+
+int
+main(void)
+{
+    const char *names[] = { "AUTO", "SCALAR", "AVX2", "AVX512" };
+    int seed = get_seed(FORCESEED);
+
+    int kernel;
+    for (kernel = HITIME_KERNEL_SCALAR; kernel <= HITIME_KERNEL_AVX512; ++kernel)
+    {
+        if (hitime_set_kernel(kernel))
+        {
+            run(names[kernel], seed);
+        }
+    }
+
+    return 0;
+}
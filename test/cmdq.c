@@ -0,0 +1,294 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file cmdq.c
+ * @author Craig Jacobson
+ * @brief Contention of the command queue against a mutex around hitime_t.
+ *
+ * Many producer threads start and stop timeouts owned by a single consumer
+ * thread, which keeps ticking the manager. The baseline locks a mutex around
+ * every call; the queue lets producers post without ever taking a lock.
+ * This needs HITIME_CMDQ.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hitime.h"
+#include "hitime_cmdq.h"
+#include "stopwatch.h"
+
+#ifndef MAXTHREADS
+#define MAXTHREADS (0)
+#endif
+
+#ifndef OPS
+#define OPS (1024*1024 * 2)
+#endif
+
+#ifndef LOCAL
+#define LOCAL (1024*16)
+#endif
+
+#ifndef CAPACITY
+#define CAPACITY (1024*64)
+#endif
+
+
+typedef struct
+{
+    hitime_t              ht;
+    hitime_cmdq_t         cmdq;
+    pthread_mutex_t       lock;
+    bool                  locked;
+    pthread_barrier_t     barrier;
+    _Atomic uint64_t      now;
+    _Atomic int           running;
+    _Atomic uint64_t      retries;
+} bench_t;
+
+typedef struct
+{
+    bench_t *    b;
+    int          index;
+    hitimeout_t *ts;
+} producer_t;
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void
+drain(hitime_t *ht)
+{
+    while (hitime_get_next(ht)) {}
+}
+
+static void
+post(bench_t *b, int op, hitimeout_t *t, hitime_time_t when)
+{
+    if (b->locked)
+    {
+        pthread_mutex_lock(&b->lock);
+        if (HITIME_CMD_START == op)
+        {
+            hitimeout_set(t, when, NULL);
+            hitime_start(&b->ht, t);
+        }
+        else
+        {
+            hitime_stop(&b->ht, t);
+        }
+        pthread_mutex_unlock(&b->lock);
+    }
+    else
+    {
+        uint64_t retries = 0;
+        bool posted;
+        do
+        {
+            if (HITIME_CMD_START == op)
+            {
+                posted = hitime_cmdq_start(&b->cmdq, t, when);
+            }
+            else
+            {
+                posted = hitime_cmdq_stop(&b->cmdq, t);
+            }
+            if (!posted)
+            {
+                ++retries;
+                sched_yield();
+            }
+        } while (!posted);
+
+        if (retries)
+        {
+            atomic_fetch_add_explicit(&b->retries, retries, memory_order_relaxed);
+        }
+    }
+}
+
+static void *
+produce(void *arg)
+{
+    producer_t *p = arg;
+    bench_t *b = p->b;
+    uint64_t state = (uint64_t)p->index * 0x9E3779B97F4A7C15ULL + 1;
+
+    pthread_barrier_wait(&b->barrier);
+
+    int i;
+    for (i = 0; i < OPS; ++i)
+    {
+        hitimeout_t *t = p->ts + (i % LOCAL);
+        uint64_t now = atomic_load_explicit(&b->now, memory_order_relaxed);
+        post(b, HITIME_CMD_STOP, t, 0);
+        post(b, HITIME_CMD_START, t, now + 1 + (xorshift64(&state) & 0xFFFF));
+    }
+
+    return NULL;
+}
+
+static void *
+consume(void *arg)
+{
+    bench_t *b = arg;
+    uint64_t now = 1;
+
+    pthread_barrier_wait(&b->barrier);
+
+    while (atomic_load_explicit(&b->running, memory_order_acquire))
+    {
+        ++now;
+        atomic_store_explicit(&b->now, now, memory_order_relaxed);
+        if (b->locked)
+        {
+            pthread_mutex_lock(&b->lock);
+            if (hitime_timeout(&b->ht, now))
+            {
+                drain(&b->ht);
+            }
+            pthread_mutex_unlock(&b->lock);
+        }
+        else if (hitime_timeout(&b->ht, now))
+        {
+            drain(&b->ht);
+        }
+    }
+
+    // Apply whatever the producers left behind
+    hitime_timeout(&b->ht, now + 1);
+
+    return NULL;
+}
+
+static void
+run(int threads, bool locked)
+{
+    stopwatch_t sw;
+    bench_t *b = aligned_alloc(_Alignof(bench_t), sizeof(bench_t));
+    hitime_init(&b->ht);
+    hitime_cmdq_init(&b->cmdq, CAPACITY);
+    if (!locked)
+    {
+        hitime_set_cmdq(&b->ht, &b->cmdq);
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    b->locked = locked;
+    pthread_barrier_init(&b->barrier, NULL, threads + 2);
+    atomic_init(&b->now, 1);
+    atomic_init(&b->running, 1);
+    atomic_init(&b->retries, 0);
+
+    producer_t *producers = calloc(threads, sizeof(producer_t));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    pthread_t consumer;
+
+    pthread_create(&consumer, NULL, consume, b);
+    int i;
+    for (i = 0; i < threads; ++i)
+    {
+        producer_t *p = producers + i;
+        p->b = b;
+        p->index = i;
+        p->ts = calloc(LOCAL, sizeof(hitimeout_t));
+        pthread_create(ids + i, NULL, produce, p);
+    }
+
+    stopwatch_reset(&sw);
+    pthread_barrier_wait(&b->barrier);
+    stopwatch_start(&sw);
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    atomic_store_explicit(&b->running, 0, memory_order_release);
+    pthread_join(consumer, NULL);
+    stopwatch_stop(&sw);
+
+    double seconds = stopwatch_elapsed(&sw);
+    double ops = 2.0 * (double)threads * (double)OPS;
+    printf("%s Producers: %d, Seconds: %f, Ops/second: %f, Retries: %lu\n",
+           locked ? "Mutex:" : "Queue:", threads, seconds, ops / seconds,
+           (unsigned long)atomic_load(&b->retries));
+
+    // Everything is applied so the timeouts can go
+    hitime_expire_all(&b->ht);
+    drain(&b->ht);
+    for (i = 0; i < threads; ++i)
+    {
+        free(producers[i].ts);
+    }
+    free(ids);
+    free(producers);
+    pthread_barrier_destroy(&b->barrier);
+    pthread_mutex_destroy(&b->lock);
+    hitime_cmdq_destroy(&b->cmdq);
+    hitime_destroy(&b->ht);
+    free(b);
+}
+
+int
+main(void)
+{
+    int maxthreads = MAXTHREADS;
+    if (!maxthreads)
+    {
+        maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+        if (maxthreads < 1)
+        {
+            maxthreads = 1;
+        }
+    }
+
+    if (!HITIME_CMDQ)
+    {
+        fprintf(stderr, "Build with HITIME_CMDQ so timing out applies the queue.\n");
+        return 1;
+    }
+
+    printf("COMMAND QUEUE CONTENTION STATS\n");
+    int threads = 1;
+    for (;;)
+    {
+        run(threads, true);
+        run(threads, false);
+        if (threads == maxthreads)
+        {
+            break;
+        }
+        threads = threads * 2 < maxthreads ? threads * 2 : maxthreads;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file cycles.h
+ * @author Craig Jacobson
+ * @brief Serialized timestamps for timing single calls.
+ *
+ * On x86 the start is LFENCE then RDTSC, so earlier instructions finish
+ * before the read, and the end is RDTSCP then LFENCE, so the call finishes
+ * before the read and later instructions wait for it. Ticks are TSC ticks,
+ * which run at a constant rate on any CPU with constant_tsc, not the core
+ * clock. Elsewhere ticks are CLOCK_MONOTONIC nanoseconds.
+ */
+#ifndef CYCLES_H_
+#define CYCLES_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#define CYCLES_TSC (1)
+#else
+#define CYCLES_TSC (0)
+#endif
+
+
+static inline uint64_t
+cycles_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @return Ticks, taken after everything before it.
+ */
+static inline uint64_t
+cycles_start(void)
+{
+#if CYCLES_TSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return cycles_ns();
+#endif
+}
+
+/**
+ * @return Ticks, taken before anything after it.
+ */
+static inline uint64_t
+cycles_stop(void)
+{
+#if CYCLES_TSC
+    unsigned int aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return cycles_ns();
+#endif
+}
+
+/**
+ * @brief Measure the ticks per nanosecond over about the given milliseconds.
+ */
+static inline double
+cycles_per_ns(int ms)
+{
+#if CYCLES_TSC
+    uint64_t ns = cycles_ns();
+    uint64_t start = cycles_start();
+    uint64_t end = ns + (uint64_t)ms * 1000000u;
+    uint64_t now;
+    while ((now = cycles_ns()) < end) {}
+    return (double)(cycles_stop() - start) / (double)(now - ns);
+#else
+    (void)ms;
+    return 1.0;
+#endif
+}
+
+#endif /* CYCLES_H_ */
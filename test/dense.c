@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file dense.c
+ * @author Craig Jacobson
+ * @brief Many short timers restarted every few ticks, as for retransmits.
+ *
+ * Every connection has a timer a few ticks out. Each tick some connections
+ * are acknowledged and touch their timer, and every expired timer is
+ * restarted. Nearly every timer is due within the ring, so with
+ * HITIME_NEAR_BITS nothing cascades. Built with and without the ring,
+ * and with 32-bit times.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hitime.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*256)
+#endif
+
+#ifndef TICKS
+#define TICKS (1024)
+#endif
+
+/* Timers are due from 1 up to this many ticks out. */
+#ifndef MAXTTL
+#define MAXTTL (200)
+#endif
+
+/* Timers touched per tick. */
+#ifndef TOUCHES
+#define TOUCHES (MAXLEN / 16)
+#endif
+
+
+static void
+print_stats(const char *name, double seconds, uint64_t ops)
+{
+    printf("%s\n", name);
+    printf("Seconds: %f\n", seconds);
+    printf("Ops/second: %f\n", (double)ops / seconds);
+}
+
+static uint64_t
+ttl(void)
+{
+    return 1 + (uint64_t)(random() % MAXTTL);
+}
+
+int
+main(void)
+{
+    stopwatch_t sw;
+    hitime_t ht;
+    uint64_t ops = 0;
+    uint64_t expired = 0;
+    int i;
+
+    srand(get_seed(FORCESEED));
+    hitime_init(&ht);
+
+    printf("%s (%d bits), %d-BIT TIMES\n", HITIME_NEAR_BITS ? "NEAR RING" : "NO RING",
+           HITIME_NEAR_BITS, HITIME_TIME_BITS);
+    printf("Manager: %zu octets, timeout: %zu octets\n", sizeof(hitime_t), sizeof(hitimeout_t));
+
+    hitimeout_t **tos = malloc(MAXLEN * sizeof(hitimeout_t *));
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        tos[i] = hitimeout_new();
+        hitimeout_set(tos[i], ttl(), NULL);
+        hitime_start(&ht, tos[i]);
+    }
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    uint64_t now;
+    for (now = 1; now <= TICKS; ++now)
+    {
+        for (i = 0; i < TOUCHES; ++i)
+        {
+            hitime_touch(&ht, tos[random() % MAXLEN], now + ttl());
+        }
+        ops += TOUCHES;
+
+        hitime_timeout(&ht, now);
+        hitimeout_t *t;
+        while ((t = hitime_get_next(&ht)))
+        {
+            t->when = now + ttl();
+            hitime_start(&ht, t);
+            ++expired;
+        }
+        ++ops;
+    }
+    stopwatch_stop(&sw);
+    ops += expired;
+    assert(MAXLEN == hitime_count_all(&ht));
+    printf("Expired: %lu\n", expired);
+    print_stats("DENSE STATS", stopwatch_elapsed(&sw), ops);
+
+    hitime_expire_all(&ht);
+    while (hitime_get_next(&ht)) {}
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_free(tos + i);
+    }
+    free(tos);
+    hitime_destroy(&ht);
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file footprint.c
+ * @author Craig Jacobson
+ * @brief Memory footprint of hitime_t against the compact arena.
+ *
+ * Starts the same set of timeouts on both managers, reports the octets each
+ * uses (computed and resident), then times expiring all of them.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hitime.h"
+#include "hitime_arena.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*1024 * 4)
+#endif
+
+#ifndef HORIZON
+#define HORIZON (1024*1024 * 64)
+#endif
+
+
+/**
+ * @return Resident octets of the process; zero if unknown.
+ */
+static size_t
+get_resident(void)
+{
+    size_t size = 0;
+    size_t resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f)
+    {
+        if (2 != fscanf(f, "%zu %zu", &size, &resident))
+        {
+            resident = 0;
+        }
+        fclose(f);
+    }
+
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void
+print_stats(const char *name, size_t computed, size_t resident, double seconds)
+{
+    printf("%s\n", name);
+    printf("Octets: %zu, Per timeout: %f\n", computed, (double)computed / MAXLEN);
+    printf("Resident: %zu, Per timeout: %f\n", resident, (double)resident / MAXLEN);
+    printf("Expire seconds: %f, Ops/second: %f\n", seconds, MAXLEN / seconds);
+}
+
+int
+main(void)
+{
+    const int maxlen = MAXLEN;
+    const uint64_t epoch = 1000;
+    stopwatch_t sw;
+    int i;
+
+    srand(get_seed(FORCESEED));
+
+    uint64_t *whens = malloc(maxlen * sizeof(uint64_t));
+    for (i = 0; i < maxlen; ++i)
+    {
+        whens[i] = epoch + 1 + (rand64() % HORIZON);
+    }
+
+    printf("FOOTPRINT STATS\n");
+    printf("Timeouts: %d\n", maxlen);
+
+    /* Pointer based manager. */
+    size_t before = get_resident();
+    hitime_t *ht = hitime_new();
+    hitimeout_t *tos = malloc(maxlen * sizeof(hitimeout_t));
+    hitime_timeout(ht, epoch);
+    for (i = 0; i < maxlen; ++i)
+    {
+        hitimeout_init(tos + i);
+        hitimeout_set(tos + i, whens[i], NULL);
+        hitime_start(ht, tos + i);
+    }
+    size_t resident = get_resident() - before;
+
+    int count = 0;
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    uint64_t wait;
+    while ((wait = hitime_get_wait(ht)) < hitime_max_wait())
+    {
+        hitime_timeout_elapse(ht, wait);
+        while (hitime_get_next(ht)) { ++count; }
+    }
+    stopwatch_stop(&sw);
+    assert(maxlen == count);
+    print_stats("HITIME", sizeof(hitime_t) + maxlen * sizeof(hitimeout_t),
+                resident, stopwatch_elapsed(&sw));
+
+    free(tos);
+    hitime_free(&ht);
+
+    /* Compact manager. */
+    before = get_resident();
+    hitime_arena_t *a = hitime_arena_new(maxlen, epoch);
+    for (i = 0; i < maxlen; ++i)
+    {
+        uint32_t id = hitime_arena_alloc(a);
+        hitime_arena_start(a, id, whens[i]);
+    }
+    resident = get_resident() - before;
+
+    count = 0;
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    while ((wait = hitime_arena_get_wait(a)) < hitime_max_wait())
+    {
+        hitime_arena_timeout(a, hitime_arena_get_last(a) + wait);
+        while (HITIME_ARENA_NIL != hitime_arena_get_next(a)) { ++count; }
+    }
+    stopwatch_stop(&sw);
+    assert(maxlen == count);
+    print_stats("ARENA", hitime_arena_footprint(a), resident, stopwatch_elapsed(&sw));
+
+    hitime_arena_free(&a);
+    free(whens);
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file keepalive.c
+ * @author Craig Jacobson
+ * @brief Idle connection workload comparing hitime_touch and hitime_touch_lazy.
+ *
+ * Every connection has an idle timeout that is pushed later on every packet.
+ * Each tick a number of random connections receive a packet and the manager
+ * is timed out. Expired connections are replaced by new ones.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hitime.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*1024)
+#endif
+
+#ifndef IDLE
+#define IDLE (10000)
+#endif
+
+#ifndef TICKS
+#define TICKS (1024*64)
+#endif
+
+#ifndef PACKETS
+#define PACKETS (256)
+#endif
+
+
+typedef void (*touch_fn)(hitime_t *, hitimeout_t *, hitime_time_t);
+
+static void
+run(const char *name, touch_fn touch, int seed)
+{
+    const int maxlen = MAXLEN;
+    const hitime_time_t idle = IDLE;
+    stopwatch_t sw;
+
+    srand(seed);
+
+    hitime_t ht;
+    hitime_init(&ht);
+
+    hitimeout_t *tos = malloc(maxlen * sizeof(hitimeout_t));
+
+    // Stagger the initial timeouts
+    hitime_time_t now = 1;
+    hitime_timeout(&ht, now);
+    int toindex = 0;
+    for (toindex = 0; toindex < maxlen; ++toindex)
+    {
+        hitimeout_init(tos + toindex);
+        hitimeout_set(tos + toindex, now + idle/2 + (random() % (idle/2)), NULL);
+        hitime_start(&ht, tos + toindex);
+    }
+
+    uint64_t touches = 0;
+    uint64_t expired = 0;
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+
+    int tick;
+    for (tick = 0; tick < TICKS; ++tick)
+    {
+        ++now;
+
+        int packet;
+        for (packet = 0; packet < PACKETS; ++packet)
+        {
+            toindex = random() % maxlen;
+            touch(&ht, tos + toindex, now + idle);
+            ++touches;
+        }
+
+        if (hitime_timeout(&ht, now))
+        {
+            hitimeout_t *t;
+            while ((t = hitime_get_next(&ht)))
+            {
+                // Replace the connection
+                hitimeout_set(t, now + idle, NULL);
+                hitime_start(&ht, t);
+                ++expired;
+            }
+        }
+    }
+
+    stopwatch_stop(&sw);
+
+    printf("%s STATS\n", name);
+    double seconds = stopwatch_elapsed(&sw);
+    printf("Seconds: %f\n", seconds);
+    printf("Touches: %lu\n", touches);
+    printf("Expired: %lu\n", expired);
+    printf("Touches/second: %f\n", (double)touches / seconds);
+
+    for (toindex = 0; toindex < maxlen; ++toindex)
+    {
+        hitime_stop(&ht, tos + toindex);
+        hitimeout_destroy(tos + toindex);
+    }
+    free(tos);
+    hitime_destroy(&ht);
+}
+
+int
+main(void)
+{
+    int seed = get_seed(FORCESEED);
+
+    if (!HITIME_LAZY_TOUCH)
+    {
+        fprintf(stderr, "Built without HITIME_LAZY_TOUCH; the lazy touch is a touch.\n");
+    }
+
+    // Same seed so both see the same packets and expire the same connections
+    run("TOUCH", hitime_touch, seed);
+    run("LAZY TOUCH", hitime_touch_lazy, seed);
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file latency.c
+ * @author Craig Jacobson
+ * @brief Time every call on its own and report the tail, not the mean.
+ *
+ * For each population from MINPOP to MAXPOP by powers of ten, and each
+ * spread of the times over the bins, the timeouts are started, then the
+ * wait is queried, timeouts touched, stopped and restarted, and the time
+ * ticks forward, restarting what expires. Last the time jumps past every
+ * timeout so one hitime_timeout takes them all. Every call of hitime_start,
+ * hitime_stop, hitime_touch, hitime_get_wait, hitime_timeout, and
+ * hitime_get_next is timed with the serialized timestamps of cycles.h.
+ *
+ * The spreads are:
+ * - near: 1 to 1024 ticks out, so the low bins
+ * - spread: an even spread over bins 0 to 39
+ * - far: all about 2^32 ticks out, so one high bin cascades
+ *
+ * Prints CSV: population, spread, call, number of calls, then p50, p99,
+ * p999, and max in ticks and in nanoseconds. A population of 1e8 needs
+ * several GiB; build with -DMAXPOP=100000000 for it.
+ */
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cycles.h"
+#include "hitime.h"
+#include "hitime_hist.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MINPOP
+#define MINPOP (1000)
+#endif
+
+#ifndef MAXPOP
+#define MAXPOP (10000000)
+#endif
+
+/* Most calls timed of each kind besides starts and expiry. */
+#ifndef SAMPLES
+#define SAMPLES (1024*1024)
+#endif
+
+#ifndef TICKS
+#define TICKS (1024)
+#endif
+
+
+enum
+{
+    CALL_START = 0,
+    CALL_STOP,
+    CALL_TOUCH,
+    CALL_WAIT,
+    CALL_TIMEOUT,
+    CALL_NEXT,
+    CALL_COUNT,
+};
+
+static const char *const call_names[CALL_COUNT] =
+{
+    "start", "stop", "touch", "get_wait", "timeout", "get_next",
+};
+
+typedef struct
+{
+    const char *name;
+    uint64_t  (*ttl)(uint64_t);//from a random number
+    uint64_t    jump;//past every timeout
+} spread_t;
+
+static uint64_t
+near_ttl(uint64_t r)
+{
+    return 1 + r % 1024;
+}
+
+static uint64_t
+spread_ttl(uint64_t r)
+{
+    uint64_t bit = (uint64_t)1 << (r % 40);
+    return bit + ((r >> 6) & (bit - 1));
+}
+
+static uint64_t
+far_ttl(uint64_t r)
+{
+    return ((uint64_t)1 << 32) + r % (1024*1024);
+}
+
+static const spread_t spreads[] =
+{
+    { "near", near_ttl, (uint64_t)1 << 11 },
+    { "spread", spread_ttl, (uint64_t)1 << 41 },
+    { "far", far_ttl, (uint64_t)1 << 33 },
+};
+
+static uint64_t rng;
+
+static inline uint64_t
+next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+#define TIMED(hist, call) \
+    do { \
+        uint64_t _start = cycles_start(); \
+        call; \
+        hitime_hist_record((hist), cycles_stop() - _start); \
+    } while (0)
+
+static void
+print_row(size_t pop, const char *spread, const char *call, const hitime_hist_t *hist, double per_ns)
+{
+    hitime_summary_t s;
+    hitime_hist_summarize(hist, &s);
+    printf("%zu,%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+           ",%.1f,%.1f,%.1f,%.1f\n",
+           pop, spread, call, s.count, s.p50, s.p99, s.p999, s.max,
+           (double)s.p50 / per_ns, (double)s.p99 / per_ns,
+           (double)s.p999 / per_ns, (double)s.max / per_ns);
+}
+
+static void
+run(hitimeout_t *tos, size_t pop, const spread_t *sp, double per_ns)
+{
+    hitime_hist_t hists[CALL_COUNT];
+    hitime_t h;
+    hitime_time_t now = 0;
+    size_t samples = pop < SAMPLES ? pop : SAMPLES;
+    size_t i;
+    int c;
+
+    for (c = 0; c < CALL_COUNT; ++c)
+    {
+        hitime_hist_reset(hists + c);
+    }
+    hitime_init(&h);
+
+    for (i = 0; i < pop; ++i)
+    {
+        hitimeout_init(tos + i);
+        hitimeout_set(tos + i, now + sp->ttl(next_rand()), NULL);
+        TIMED(hists + CALL_START, hitime_start(&h, tos + i));
+    }
+
+    volatile uint64_t wait = 0;
+    for (i = 0; i < samples; ++i)
+    {
+        TIMED(hists + CALL_WAIT, wait = hitime_get_wait(&h));
+    }
+    (void)wait;
+
+    for (i = 0; i < samples; ++i)
+    {
+        hitimeout_t *t = tos + next_rand() % pop;
+        hitime_time_t when = now + sp->ttl(next_rand());
+        TIMED(hists + CALL_TOUCH, hitime_touch(&h, t, when));
+    }
+
+    for (i = 0; i < samples; ++i)
+    {
+        hitimeout_t *t = tos + next_rand() % pop;
+        TIMED(hists + CALL_STOP, hitime_stop(&h, t));
+        t->when = now + sp->ttl(next_rand());
+        TIMED(hists + CALL_START, hitime_start(&h, t));
+    }
+
+    hitimeout_t *t;
+    int tick;
+    for (tick = 0; tick < TICKS; ++tick)
+    {
+        ++now;
+        TIMED(hists + CALL_TIMEOUT, hitime_timeout(&h, now));
+        for (;;)
+        {
+            uint64_t start = cycles_start();
+            t = hitime_get_next(&h);
+            uint64_t end = cycles_stop();
+            if (!t)
+            {
+                break;
+            }
+            hitime_hist_record(hists + CALL_NEXT, end - start);
+            t->when = now + sp->ttl(next_rand());
+            hitime_start(&h, t);
+        }
+    }
+
+    now += sp->jump;
+    TIMED(hists + CALL_TIMEOUT, hitime_timeout(&h, now));
+    size_t taken = 0;
+    for (;;)
+    {
+        uint64_t start = cycles_start();
+        t = hitime_get_next(&h);
+        uint64_t end = cycles_stop();
+        if (!t)
+        {
+            break;
+        }
+        hitime_hist_record(hists + CALL_NEXT, end - start);
+        ++taken;
+    }
+    assert(taken == pop);
+    (void)taken;
+    hitime_destroy(&h);
+
+    for (c = 0; c < CALL_COUNT; ++c)
+    {
+        print_row(pop, sp->name, call_names[c], hists + c, per_ns);
+    }
+    fflush(stdout);
+}
+
+int
+main(void)
+{
+    rng = (uint64_t)get_seed(FORCESEED) * 0x9e3779b97f4a7c15ULL | 1;
+
+    double per_ns = cycles_per_ns(100);
+    hitime_hist_t overhead;
+    hitime_hist_reset(&overhead);
+    int i;
+    for (i = 0; i < SAMPLES; ++i)
+    {
+        TIMED(&overhead, (void)0);
+    }
+    hitime_summary_t s;
+    hitime_hist_summarize(&overhead, &s);
+    printf("Ticks: %s, %.3f per ns; overhead p50 %" PRIu64 ", p99 %" PRIu64 " (not subtracted)\n",
+           CYCLES_TSC ? "TSC" : "ns", per_ns, s.p50, s.p99);
+
+    hitimeout_t *tos = malloc((size_t)MAXPOP * sizeof(hitimeout_t));
+    if (!tos)
+    {
+        fprintf(stderr, "Cannot allocate %zu timeouts\n", (size_t)MAXPOP);
+        return 1;
+    }
+
+    printf("population,spread,call,calls,p50,p99,p999,max,ns_p50,ns_p99,ns_p999,ns_max\n");
+    size_t pop;
+    for (pop = MINPOP; pop <= MAXPOP; pop *= 10)
+    {
+        size_t si;
+        for (si = 0; si < sizeof(spreads) / sizeof(spreads[0]); ++si)
+        {
+            run(tos, pop, spreads + si, per_ns);
+        }
+    }
+
+    free(tos);
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file perfctr.h
+ * @author Craig Jacobson
+ * @brief Hardware counters around the timed phases of the benchmarks.
+ *
+ * Counts cycles, instructions, L1 data and last level cache misses,
+ * branch misses, and data TLB misses of this thread in user space through
+ * perf_event_open. Each counter is opened on its own, so the ones the CPU
+ * or kernel lack are left out and the rest still count; with none, such as
+ * off Linux, in a VM without a PMU, or with perf_event_paranoid above 2,
+ * the benchmarks print the reason from perfctr_why once and time as before.
+ * Counts are scaled up when the kernel multiplexes the counters.
+ */
+#ifndef PERFCTR_H_
+#define PERFCTR_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+enum
+{
+    PERFCTR_CYCLES = 0,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_COUNT,
+};
+
+typedef struct
+{
+    int      fd[PERFCTR_COUNT];//-1 if unavailable
+    uint64_t base[PERFCTR_COUNT][3];//value, enabled, and running at start
+    double   value[PERFCTR_COUNT];//counted between start and stop
+    int      opened;
+    int      err;//errno of the first counter that failed to open
+} perfctr_t;
+
+static const char *const perfctr_names[PERFCTR_COUNT] =
+{
+    "Cycles", "Instructions", "L1d misses", "LLC misses", "Branch misses", "dTLB misses",
+};
+
+#if defined __linux__
+static inline int
+perfctr_open_one(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define PERFCTR_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+/**
+ * @brief Open the counters of the calling thread.
+ * @return The number of counters opened.
+ */
+static inline int
+perfctr_open(perfctr_t *pc)
+{
+    int i;
+    memset(pc, 0, sizeof(*pc));
+#if defined __linux__
+    static const struct { uint32_t type; uint64_t config; } events[PERFCTR_COUNT] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERFCTR_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+        { PERF_TYPE_HW_CACHE, PERFCTR_CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERFCTR_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    };
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        pc->fd[i] = perfctr_open_one(events[i].type, events[i].config);
+        if (pc->fd[i] >= 0)
+        {
+            ++pc->opened;
+        }
+        else if (!pc->err)
+        {
+            pc->err = errno;
+        }
+    }
+#else
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        pc->fd[i] = -1;
+    }
+    pc->err = ENOSYS;
+#endif
+    return pc->opened;
+}
+
+/**
+ * @return Why the first counter that failed did not open; NULL if all opened.
+ */
+static inline const char *
+perfctr_why(const perfctr_t *pc)
+{
+    return pc->err ? strerror(pc->err) : NULL;
+}
+
+static inline void
+perfctr_close(perfctr_t *pc)
+{
+#if defined __linux__
+    int i;
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        if (pc->fd[i] >= 0)
+        {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+    }
+#endif
+    pc->opened = 0;
+}
+
+/**
+ * @return True if the counter is open and its value was read.
+ */
+static inline bool
+perfctr_has(const perfctr_t *pc, int counter)
+{
+    return pc->fd[counter] >= 0;
+}
+
+static inline void
+perfctr_start(perfctr_t *pc)
+{
+#if defined __linux__
+    int i;
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        if (pc->fd[i] >= 0 && sizeof(pc->base[i]) != read(pc->fd[i], pc->base[i], sizeof(pc->base[i])))
+        {
+            memset(pc->base[i], 0, sizeof(pc->base[i]));
+        }
+    }
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        if (pc->fd[i] >= 0)
+        {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    (void)pc;
+#endif
+}
+
+static inline void
+perfctr_stop(perfctr_t *pc)
+{
+#if defined __linux__
+    int i;
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        if (pc->fd[i] >= 0)
+        {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (i = 0; i < PERFCTR_COUNT; ++i)
+    {
+        uint64_t now[3];
+        pc->value[i] = 0;
+        if (pc->fd[i] < 0 || sizeof(now) != read(pc->fd[i], now, sizeof(now)))
+        {
+            continue;
+        }
+        double value = (double)(now[0] - pc->base[i][0]);
+        uint64_t enabled = now[1] - pc->base[i][1];
+        uint64_t running = now[2] - pc->base[i][2];
+        pc->value[i] = running ? value * (double)enabled / (double)running : 0;
+    }
+#else
+    (void)pc;
+#endif
+}
+
+/**
+ * @brief Print each counter divided by the operations, and instructions per cycle.
+ */
+static inline void
+perfctr_print(const perfctr_t *pc, uint64_t ops)
+{
+    int i;
+    for (i = 0; i < PERFCTR_COUNT && ops; ++i)
+    {
+        if (perfctr_has(pc, i))
+        {
+            printf("%s/op: %f\n", perfctr_names[i], pc->value[i] / (double)ops);
+        }
+    }
+    if (perfctr_has(pc, PERFCTR_CYCLES) && perfctr_has(pc, PERFCTR_INSTRUCTIONS)
+        && pc->value[PERFCTR_CYCLES] > 0)
+    {
+        printf("IPC: %f\n", pc->value[PERFCTR_INSTRUCTIONS] / pc->value[PERFCTR_CYCLES]);
+    }
+}
+
+#endif /* PERFCTR_H_ */
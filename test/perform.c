@@ -33,6 +33,7 @@
 #include <time.h>
 
 #include "hitime.h"
+#include "perfctr.h"
 
 #ifndef FORCESEED
 #define FORCESEED (0)
@@ -46,6 +47,10 @@
 #define MAXLEN (1024*1024 * 256)
 #endif
 
+#ifndef BATCH
+#define BATCH (1024*16)
+#endif
+
 
 typedef struct
 {
@@ -98,6 +103,13 @@ rand64(void)
     return ((uint64_t)arr[0] << 32) ^ (uint64_t)arr[1];
 }
 
+static void
+count_drained(hitimeout_t *t, void *ctx)
+{
+    (void)t;
+    ++*(int *)ctx;
+}
+
 int
 main(void)
 {
@@ -114,6 +126,12 @@ main(void)
     printf("Seed: %d\n", seed);
     srand(seed);
 
+    perfctr_t pc;
+    if (!perfctr_open(&pc))
+    {
+        printf("Counters: unavailable (%s)\n", perfctr_why(&pc));
+    }
+
     int iter = 0;
     for (iter = 0; iter < maxiter; ++iter)
     {
@@ -134,6 +152,7 @@ main(void)
 
         // Time starts
         stopwatch_start(&sw);
+        perfctr_start(&pc);
 
         // Start all timeouts
         for (toindex = 0; toindex < maxlen; ++toindex)
@@ -142,6 +161,7 @@ main(void)
         }
 
         // Time stops
+        perfctr_stop(&pc);
         stopwatch_stop(&sw);
 
         // Print stats
@@ -151,10 +171,38 @@ main(void)
         printf("Seconds: %f\n", seconds);
         double ops_per_second = (double)maxlen / seconds;
         printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
 
         // Reset and start stopwatch
         stopwatch_reset(&sw);
         stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Query the wait as an event loop would
+        volatile uint64_t wait = 0;
+        for (toindex = 0; toindex < maxlen; ++toindex)
+        {
+            wait = hitime_get_wait(&ht);
+        }
+        (void)wait;
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("WAIT STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
 
         // Stop all timeouts
         for (toindex = 0; toindex < maxlen; ++toindex)
@@ -163,6 +211,7 @@ main(void)
         }
 
         // Time stops
+        perfctr_stop(&pc);
         stopwatch_stop(&sw);
 
         // Print stats
@@ -172,6 +221,173 @@ main(void)
         printf("Seconds: %f\n", seconds);
         ops_per_second = (double)maxlen / seconds;
         printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Batches arrive in no particular order, so compare on a shuffle
+        hitimeout_t **order = malloc(maxlen * sizeof(hitimeout_t *));
+        for (toindex = 0; toindex < maxlen; ++toindex)
+        {
+            order[toindex] = tos + toindex;
+        }
+        for (toindex = maxlen - 1; toindex > 0; --toindex)
+        {
+            int other = (int)(rand64() % (uint64_t)(toindex + 1));
+            hitimeout_t *swap = order[toindex];
+            order[toindex] = order[other];
+            order[other] = swap;
+        }
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Start all timeouts one at a time
+        for (toindex = 0; toindex < maxlen; ++toindex)
+        {
+            hitime_start(&ht, order[toindex]);
+        }
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("SHUFFLED START STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Stop all timeouts one at a time
+        for (toindex = 0; toindex < maxlen; ++toindex)
+        {
+            hitime_stop(&ht, order[toindex]);
+        }
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("SHUFFLED STOP STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Start all timeouts in batches
+        for (toindex = 0; toindex < maxlen; toindex += BATCH)
+        {
+            int len = maxlen - toindex < BATCH ? maxlen - toindex : BATCH;
+            hitime_start_many(&ht, order + toindex, len);
+        }
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("SHUFFLED START MANY STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Stop all timeouts in batches
+        for (toindex = 0; toindex < maxlen; toindex += BATCH)
+        {
+            int len = maxlen - toindex < BATCH ? maxlen - toindex : BATCH;
+            hitime_stop_many(&ht, order + toindex, len);
+        }
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("SHUFFLED STOP MANY STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        // Expire everything in the shuffled order for both loops
+        hitime_start_many(&ht, order, maxlen);
+        hitime_expire_all(&ht);
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Take expired timeouts one at a time
+        while (hitime_get_next(&ht)) {}
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("GET NEXT STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        hitime_start_many(&ht, order, maxlen);
+        hitime_expire_all(&ht);
+        int drained = 0;
+
+        // Reset and start stopwatch
+        stopwatch_reset(&sw);
+        stopwatch_start(&sw);
+        perfctr_start(&pc);
+
+        // Hand expired timeouts to a callback
+        hitime_drain(&ht, count_drained, &drained, 0);
+
+        // Time stops
+        perfctr_stop(&pc);
+        stopwatch_stop(&sw);
+
+        // Print stats
+        printf("DRAIN STATS\n");
+        printf("Iteration: %d (of %d)\n", iter, maxiter);
+        seconds = stopwatch_elapsed(&sw);
+        printf("Seconds: %f\n", seconds);
+        ops_per_second = (double)maxlen / seconds;
+        printf("Ops/second: %f\n", ops_per_second);
+        perfctr_print(&pc, maxlen);
+
+        assert(drained == maxlen);
+
+        free(order);
 
         // Destroy data
         for (toindex = 0; toindex < maxlen; ++toindex)
@@ -181,5 +397,7 @@ main(void)
         free(tos);
     }
 
+    perfctr_close(&pc);
+
     return 0;
 }
@@ -0,0 +1,144 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file pool.c
+ * @author Craig Jacobson
+ * @brief Allocation and expiry with malloc against the slab pool.
+ *
+ * Timeouts are allocated with hitimeout_new alongside other allocations,
+ * as an application would, started, expired by following the wait, and
+ * freed. The same run is repeated with the default pool set.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hitime.h"
+#include "hitime_pool.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*1024 * 2)
+#endif
+
+#ifndef HORIZON
+#define HORIZON (1024*1024 * 16)
+#endif
+
+
+static void
+print_stats(const char *name, double seconds)
+{
+    printf("%s\n", name);
+    printf("Seconds: %f\n", seconds);
+    printf("Ops/second: %f\n", (double)MAXLEN / seconds);
+}
+
+static void
+run(const char *name, hitime_pool_t *p)
+{
+    stopwatch_t sw;
+    hitime_t ht;
+    int i;
+
+    hitime_pool_set_default(p);
+    hitime_init(&ht);
+
+    hitimeout_t **tos = malloc(MAXLEN * sizeof(hitimeout_t *));
+    void **others = malloc(MAXLEN * sizeof(void *));
+
+    printf("%s\n", name);
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        tos[i] = hitimeout_new();
+        // The rest of the application allocates too
+        others[i] = malloc(16 + (random() & 0xFF));
+    }
+    stopwatch_stop(&sw);
+    print_stats("ALLOC STATS", stopwatch_elapsed(&sw));
+
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_set(tos[i], 1 + (random() % HORIZON), NULL);
+        hitime_start(&ht, tos[i]);
+    }
+
+    int count = 0;
+    uint64_t wait;
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    while ((wait = hitime_get_wait(&ht)) < hitime_max_wait())
+    {
+        hitime_timeout_elapse(&ht, wait);
+        while (hitime_get_next(&ht)) { ++count; }
+    }
+    stopwatch_stop(&sw);
+    assert(MAXLEN == count);
+    print_stats("EXPIRE STATS", stopwatch_elapsed(&sw));
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_free(tos + i);
+    }
+    stopwatch_stop(&sw);
+    print_stats("FREE STATS", stopwatch_elapsed(&sw));
+
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        free(others[i]);
+    }
+    free(others);
+    free(tos);
+    hitime_destroy(&ht);
+    hitime_pool_set_default(NULL);
+}
+
+int
+main(void)
+{
+    int seed = get_seed(FORCESEED);
+
+    srand(seed);
+    run("MALLOC", NULL);
+
+    hitime_pool_t *p = hitime_pool_new(0, 0);
+    srand(seed);
+    run("POOL", p);
+    hitime_pool_free(&p);
+
+    p = hitime_pool_new(0, HITIME_POOL_HUGE);
+    srand(seed);
+    run("POOL HUGE", p);
+    hitime_pool_free(&p);
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file radix.c
+ * @author Craig Jacobson
+ * @brief Long timeouts in hitime_t against the radix manager.
+ *
+ * Every timeout is started with a long time to live and the wait is
+ * followed until all expire. The radix manager reports how many times
+ * timeouts were moved to a lower level; with a radix of 2 it is the
+ * same layout as hitime_t.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hitime.h"
+#include "hitime_radix.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*1024)
+#endif
+
+/* Times to live are between 2**MINTTL and 2**MAXTTL. */
+#ifndef MINTTL
+#define MINTTL (20)
+#endif
+
+#ifndef MAXTTL
+#define MAXTTL (36)
+#endif
+
+
+static void
+set_times(hitimeout_t *tos, int seed)
+{
+    srand(seed);
+
+    int i;
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_init(tos + i);
+        int shift = MINTTL + (int)(random() % (MAXTTL - MINTTL));
+        uint64_t ttl = (((uint64_t)1) << shift) + (rand64() & ((((uint64_t)1) << shift) - 1));
+        hitimeout_set(tos + i, ttl, NULL);
+    }
+}
+
+static void
+print_stats(const char *name, double seconds, uint64_t moves)
+{
+    printf("%s\n", name);
+    printf("Seconds: %f\n", seconds);
+    printf("Ops/second: %f\n", (double)MAXLEN / seconds);
+    if (moves)
+    {
+        printf("Moves: %lu\n", (unsigned long)moves);
+        printf("Moves/timeout: %f\n", (double)moves / MAXLEN);
+    }
+}
+
+static void
+run_hitime(hitimeout_t *tos, int seed)
+{
+    stopwatch_t sw;
+    hitime_t ht;
+    int i;
+
+    set_times(tos, seed);
+    hitime_init(&ht);
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitime_start(&ht, tos + i);
+    }
+    int count = 0;
+    uint64_t wait;
+    while ((wait = hitime_get_wait(&ht)) < hitime_max_wait())
+    {
+        hitime_timeout_elapse(&ht, wait);
+        while (hitime_get_next(&ht)) { ++count; }
+    }
+    stopwatch_stop(&sw);
+    assert(MAXLEN == count);
+
+    print_stats("HITIME", stopwatch_elapsed(&sw), 0);
+    hitime_destroy(&ht);
+}
+
+static void
+run_radix(hitimeout_t *tos, int seed, int bits)
+{
+    stopwatch_t sw;
+    hitime_radix_t r;
+    char name[32];
+    int i;
+
+    set_times(tos, seed);
+    hitime_radix_init(&r, bits);
+
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitime_radix_start(&r, tos + i);
+    }
+    int count = 0;
+    uint64_t wait;
+    while ((wait = hitime_radix_get_wait(&r)) < hitime_max_wait())
+    {
+        hitime_radix_timeout(&r, hitime_radix_get_last(&r) + wait);
+        while (hitime_radix_get_next(&r)) { ++count; }
+    }
+    stopwatch_stop(&sw);
+    assert(MAXLEN == count);
+
+    snprintf(name, sizeof(name), "RADIX 2**%d", bits);
+    print_stats(name, stopwatch_elapsed(&sw), hitime_radix_get_moves(&r));
+    hitime_radix_destroy(&r);
+}
+
+int
+main(void)
+{
+    int seed = get_seed(FORCESEED);
+    hitimeout_t *tos = malloc(MAXLEN * sizeof(hitimeout_t));
+
+    run_hitime(tos, seed);
+
+    int bits;
+    for (bits = 1; bits <= HITIME_RADIX_MAX_BITS; ++bits)
+    {
+        run_radix(tos, seed, bits);
+    }
+
+    free(tos);
+    return 0;
+}
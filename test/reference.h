@@ -0,0 +1,528 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file reference.h
+ * @author Craig Jacobson
+ * @brief Reference timer designs for comparing against hitime.
+ *
+ * A binary heap, a hashed wheel (Varghese and Lauck scheme 6), and a
+ * cascading hierarchical wheel as in classic Linux. All share ref_timer_t
+ * and expire every timer due at or before the time given, in no set order.
+ * They are plain and correct rather than tuned.
+ */
+#ifndef REFERENCE_H_
+#define REFERENCE_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define REF_IDLE (SIZE_MAX)
+
+/* Timer
+ * The heap only uses the index; the wheels only use the links.
+ */
+typedef struct ref_timer_s
+{
+    struct ref_timer_s * next;
+    struct ref_timer_s * prev;
+    uint64_t             when;
+    size_t               index;
+} ref_timer_t;
+
+typedef void (*ref_expire_cb)(ref_timer_t *, void *);
+
+static inline void
+ref_timer_init(ref_timer_t *t)
+{
+    t->next = NULL;
+    t->prev = NULL;
+    t->when = 0;
+    t->index = REF_IDLE;
+}
+
+
+/*******************************************************************************
+ * LIST FUNCTIONS
+*******************************************************************************/
+
+static inline void
+ref_list_clear(ref_timer_t *l)
+{
+    l->next = l;
+    l->prev = l;
+}
+
+static inline void
+ref_list_nq(ref_timer_t *l, ref_timer_t *t)
+{
+    t->next = l;
+    t->prev = l->prev;
+    l->prev->next = t;
+    l->prev = t;
+}
+
+static inline void
+ref_list_unlink(ref_timer_t *t)
+{
+    t->next->prev = t->prev;
+    t->prev->next = t->next;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+/**
+ * @brief Move the list to the given head, emptying it.
+ */
+static inline void
+ref_list_take(ref_timer_t *l, ref_timer_t *to)
+{
+    if (l->next == l)
+    {
+        ref_list_clear(to);
+        return;
+    }
+    to->next = l->next;
+    to->prev = l->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    ref_list_clear(l);
+}
+
+
+/*******************************************************************************
+ * BINARY HEAP
+*******************************************************************************/
+
+typedef struct
+{
+    ref_timer_t ** a;
+    size_t         len;
+    size_t         cap;
+} ref_heap_t;
+
+static inline void
+ref_heap_init(ref_heap_t *h)
+{
+    h->a = NULL;
+    h->len = 0;
+    h->cap = 0;
+}
+
+static inline void
+ref_heap_destroy(ref_heap_t *h)
+{
+    free(h->a);
+    ref_heap_init(h);
+}
+
+static inline void
+ref_heap_set(ref_heap_t *h, size_t i, ref_timer_t *t)
+{
+    h->a[i] = t;
+    t->index = i;
+}
+
+static inline void
+ref_heap_up(ref_heap_t *h, size_t i)
+{
+    ref_timer_t *t = h->a[i];
+    while (i)
+    {
+        size_t parent = (i - 1) / 2;
+        if (h->a[parent]->when <= t->when)
+        {
+            break;
+        }
+        ref_heap_set(h, i, h->a[parent]);
+        i = parent;
+    }
+    ref_heap_set(h, i, t);
+}
+
+static inline void
+ref_heap_down(ref_heap_t *h, size_t i)
+{
+    ref_timer_t *t = h->a[i];
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= h->len)
+        {
+            break;
+        }
+        if (child + 1 < h->len && h->a[child + 1]->when < h->a[child]->when)
+        {
+            ++child;
+        }
+        if (t->when <= h->a[child]->when)
+        {
+            break;
+        }
+        ref_heap_set(h, i, h->a[child]);
+        i = child;
+    }
+    ref_heap_set(h, i, t);
+}
+
+static inline void
+ref_heap_start(ref_heap_t *h, ref_timer_t *t)
+{
+    if (REF_IDLE != t->index)
+    {
+        return;
+    }
+    if (h->len == h->cap)
+    {
+        h->cap = h->cap ? h->cap * 2 : 1024;
+        h->a = realloc(h->a, h->cap * sizeof(*h->a));
+        assert(h->a);
+    }
+    ref_heap_set(h, h->len++, t);
+    ref_heap_up(h, t->index);
+}
+
+static inline void
+ref_heap_stop(ref_heap_t *h, ref_timer_t *t)
+{
+    size_t i = t->index;
+    if (REF_IDLE == i)
+    {
+        return;
+    }
+    t->index = REF_IDLE;
+
+    ref_timer_t *last = h->a[--h->len];
+    if (last == t)
+    {
+        return;
+    }
+    ref_heap_set(h, i, last);
+    if (i && h->a[(i - 1) / 2]->when > last->when)
+    {
+        ref_heap_up(h, i);
+    }
+    else
+    {
+        ref_heap_down(h, i);
+    }
+}
+
+static inline void
+ref_heap_touch(ref_heap_t *h, ref_timer_t *t, uint64_t when)
+{
+    if (REF_IDLE == t->index)
+    {
+        t->when = when;
+        ref_heap_start(h, t);
+        return;
+    }
+
+    uint64_t prior = t->when;
+    t->when = when;
+    if (when < prior)
+    {
+        ref_heap_up(h, t->index);
+    }
+    else
+    {
+        ref_heap_down(h, t->index);
+    }
+}
+
+static inline void
+ref_heap_expire(ref_heap_t *h, uint64_t now, ref_expire_cb cb, void *ctx)
+{
+    while (h->len && h->a[0]->when <= now)
+    {
+        ref_timer_t *t = h->a[0];
+        ref_heap_stop(h, t);
+        cb(t, ctx);
+    }
+}
+
+
+/*******************************************************************************
+ * HASHED WHEEL
+*******************************************************************************/
+
+#ifndef REF_HASH_BITS
+#define REF_HASH_BITS (12)
+#endif
+#define REF_HASH_SLOTS (1 << REF_HASH_BITS)
+
+/* Every slot is scanned as its time passes; timers a lap or more out
+ * stay in the slot until their time comes around.
+ */
+typedef struct
+{
+    uint64_t    last;
+    ref_timer_t slots[REF_HASH_SLOTS];
+} ref_hash_t;
+
+static inline void
+ref_hash_init(ref_hash_t *w)
+{
+    w->last = 0;
+    int i;
+    for (i = 0; i < REF_HASH_SLOTS; ++i)
+    {
+        ref_list_clear(w->slots + i);
+    }
+}
+
+static inline void
+ref_hash_start(ref_hash_t *w, ref_timer_t *t)
+{
+    if (t->next)
+    {
+        return;
+    }
+    /* Timers already due wait in the slot scanned next. */
+    uint64_t at = t->when > w->last ? t->when : w->last + 1;
+    ref_list_nq(w->slots + (at & (REF_HASH_SLOTS - 1)), t);
+}
+
+static inline void
+ref_hash_stop(ref_hash_t *w, ref_timer_t *t)
+{
+    (void)w;
+    if (t->next)
+    {
+        ref_list_unlink(t);
+    }
+}
+
+static inline void
+ref_hash_touch(ref_hash_t *w, ref_timer_t *t, uint64_t when)
+{
+    ref_hash_stop(w, t);
+    t->when = when;
+    ref_hash_start(w, t);
+}
+
+static inline void
+ref_hash_scan(ref_timer_t *l, uint64_t now, ref_expire_cb cb, void *ctx)
+{
+    ref_timer_t *t = l->next;
+    while (t != l)
+    {
+        ref_timer_t *next = t->next;
+        if (t->when <= now)
+        {
+            ref_list_unlink(t);
+            cb(t, ctx);
+        }
+        t = next;
+    }
+}
+
+static inline void
+ref_hash_expire(ref_hash_t *w, uint64_t now, ref_expire_cb cb, void *ctx)
+{
+    if (now <= w->last)
+    {
+        return;
+    }
+
+    uint64_t from = w->last + 1;
+    uint64_t count = now - w->last;
+    if (count > REF_HASH_SLOTS)
+    {
+        count = REF_HASH_SLOTS;
+    }
+    w->last = now;
+
+    uint64_t i;
+    for (i = 0; i < count; ++i)
+    {
+        ref_hash_scan(w->slots + ((from + i) & (REF_HASH_SLOTS - 1)), now, cb, ctx);
+    }
+}
+
+
+/*******************************************************************************
+ * HIERARCHICAL WHEEL
+*******************************************************************************/
+
+#define REF_ROOT_BITS (8)
+#define REF_ROOT_SLOTS (1 << REF_ROOT_BITS)
+#define REF_LEVEL_BITS (6)
+#define REF_LEVEL_SLOTS (1 << REF_LEVEL_BITS)
+#define REF_LEVELS ((64 - REF_ROOT_BITS + REF_LEVEL_BITS - 1) / REF_LEVEL_BITS)
+
+/* A root wheel of exact ticks and coarser wheels above it. Each tick runs
+ * one root slot; when the root wraps the next slot of the wheel above is
+ * cascaded down, and so on up.
+ */
+typedef struct
+{
+    uint64_t    next;//next tick to run
+    size_t      count;
+    ref_timer_t due;//started after their time
+    ref_timer_t root[REF_ROOT_SLOTS];
+    ref_timer_t levels[REF_LEVELS][REF_LEVEL_SLOTS];
+} ref_wheel_t;
+
+static inline void
+ref_wheel_init(ref_wheel_t *w)
+{
+    w->next = 1;
+    w->count = 0;
+    ref_list_clear(&w->due);
+    int i, j;
+    for (i = 0; i < REF_ROOT_SLOTS; ++i)
+    {
+        ref_list_clear(w->root + i);
+    }
+    for (i = 0; i < REF_LEVELS; ++i)
+    {
+        for (j = 0; j < REF_LEVEL_SLOTS; ++j)
+        {
+            ref_list_clear(w->levels[i] + j);
+        }
+    }
+}
+
+/**
+ * @brief Add a timer due at or after the next tick.
+ */
+static inline void
+ref_wheel_add(ref_wheel_t *w, ref_timer_t *t)
+{
+    uint64_t delta = t->when - w->next;
+    if (delta < REF_ROOT_SLOTS)
+    {
+        ref_list_nq(w->root + (t->when & (REF_ROOT_SLOTS - 1)), t);
+        return;
+    }
+
+    int level = 0;
+    int shift = REF_ROOT_BITS;
+    while (level < REF_LEVELS - 1 && (delta >> (shift + REF_LEVEL_BITS)))
+    {
+        ++level;
+        shift += REF_LEVEL_BITS;
+    }
+    ref_list_nq(w->levels[level] + ((t->when >> shift) & (REF_LEVEL_SLOTS - 1)), t);
+}
+
+static inline void
+ref_wheel_start(ref_wheel_t *w, ref_timer_t *t)
+{
+    if (t->next)
+    {
+        return;
+    }
+    ++w->count;
+    if (t->when < w->next)
+    {
+        ref_list_nq(&w->due, t);
+    }
+    else
+    {
+        ref_wheel_add(w, t);
+    }
+}
+
+static inline void
+ref_wheel_stop(ref_wheel_t *w, ref_timer_t *t)
+{
+    if (t->next)
+    {
+        ref_list_unlink(t);
+        --w->count;
+    }
+}
+
+static inline void
+ref_wheel_touch(ref_wheel_t *w, ref_timer_t *t, uint64_t when)
+{
+    ref_wheel_stop(w, t);
+    t->when = when;
+    ref_wheel_start(w, t);
+}
+
+/**
+ * @return The slot cascaded, so zero means the level above is due too.
+ */
+static inline int
+ref_wheel_cascade(ref_wheel_t *w, int level)
+{
+    int shift = REF_ROOT_BITS + level * REF_LEVEL_BITS;
+    int slot = (int)((w->next >> shift) & (REF_LEVEL_SLOTS - 1));
+    ref_timer_t l;
+    ref_list_take(w->levels[level] + slot, &l);
+    while (l.next != &l)
+    {
+        ref_timer_t *t = l.next;
+        ref_list_unlink(t);
+        ref_wheel_add(w, t);
+    }
+    return slot;
+}
+
+static inline void
+ref_wheel_expire(ref_wheel_t *w, uint64_t now, ref_expire_cb cb, void *ctx)
+{
+    while (w->due.next != &w->due)
+    {
+        ref_timer_t *t = w->due.next;
+        ref_list_unlink(t);
+        --w->count;
+        cb(t, ctx);
+    }
+
+    while (w->next <= now)
+    {
+        if (!w->count)
+        {
+            w->next = now + 1;
+            break;
+        }
+
+        int slot = (int)(w->next & (REF_ROOT_SLOTS - 1));
+        if (!slot)
+        {
+            int level = 0;
+            while (level < REF_LEVELS && !ref_wheel_cascade(w, level))
+            {
+                ++level;
+            }
+        }
+
+        ref_timer_t *l = w->root + slot;
+        while (l->next != l)
+        {
+            ref_timer_t *t = l->next;
+            ref_list_unlink(t);
+            --w->count;
+            cb(t, ctx);
+        }
+        ++w->next;
+    }
+}
+
+#endif /* REFERENCE_H_ */
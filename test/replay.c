@@ -0,0 +1,391 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file replay.c
+ * @author Craig Jacobson
+ * @brief Replay a trace of calls into a fresh manager as fast as possible.
+ *
+ * Usage: replay [TRACE]
+ * Without a trace, records a seeded workload of starts, stops, touches,
+ * and timeouts into a temporary trace first; this needs HITIME_TRACE.
+ * The timeouts of the trace are told apart by their address, and each is
+ * mapped onto a timeout of the replay before any call is timed.
+ *
+ * The trace is replayed twice: once untimed for the throughput, and once
+ * timing every call for its latency by operation. The clock's own overhead
+ * is printed, since it is not subtracted. Expired timeouts taken in a
+ * different order than recorded are counted as mismatches; with the same
+ * build options there should be none.
+ *
+ * A trace attached to a running manager starts with its last time, which
+ * the fresh manager is advanced to first. Timeouts that were already in
+ * the manager are only known from when the trace first starts or touches
+ * them; those taken as expired before then are counted and skipped.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hitime.h"
+#include "hitime_hist.h"
+#include "hitime_trace.h"
+#include "stopwatch.h"
+
+#ifndef FORCESEED
+#define FORCESEED (0)
+#endif
+
+#ifndef MAXLEN
+#define MAXLEN (1024*64)
+#endif
+
+#ifndef TICKS
+#define TICKS (1024)
+#endif
+
+/* Operations per tick of the recorded workload, besides expiries. */
+#ifndef OPS
+#define OPS (MAXLEN / 16)
+#endif
+
+#define NO_INDEX (UINT32_MAX)
+#define UNTRACKED (UINT32_MAX - 1)
+
+
+/**
+ * @brief Record the workload: timers a few ticks to a few thousand out,
+ *        touched, lazily touched, stopped, and restarted on expiry.
+ */
+static void
+record(const char *path)
+{
+    hitime_t h;
+    hitimeout_t *tos = calloc(MAXLEN, sizeof(hitimeout_t));
+    hitime_trace_t *tr = hitime_trace_open(path);
+    if (!tr)
+    {
+        fprintf(stderr, "Cannot open trace: %s\n", path);
+        exit(1);
+    }
+
+    hitime_init(&h);
+    hitime_set_trace(&h, tr);
+
+    int i;
+    for (i = 0; i < MAXLEN; ++i)
+    {
+        hitimeout_init(tos + i);
+        hitimeout_set(tos + i, 1 + (uint64_t)(random() % 4096), NULL);
+        hitime_start(&h, tos + i);
+    }
+
+    uint64_t now;
+    for (now = 1; now <= TICKS; ++now)
+    {
+        for (i = 0; i < OPS; ++i)
+        {
+            hitimeout_t *t = tos + random() % MAXLEN;
+            uint64_t ttl = 1 + (uint64_t)(random() % 4096);
+            switch (random() % 4)
+            {
+                case 0:
+                    hitime_touch(&h, t, now + ttl);
+                    break;
+                case 1:
+                    hitime_touch_lazy(&h, t, now + ttl);
+                    break;
+                case 2:
+                    hitime_stop(&h, t);
+                    break;
+                default:
+                    if (!t->node.next)
+                    {
+                        t->when = now + ttl;
+                        hitime_start(&h, t);
+                    }
+                    break;
+            }
+        }
+
+        hitime_timeout(&h, now);
+        hitimeout_t *t;
+        while ((t = hitime_get_next(&h)))
+        {
+            t->when = now + 1 + (uint64_t)(random() % 64);
+            hitime_start(&h, t);
+        }
+    }
+
+    hitime_set_trace(&h, NULL);
+    hitime_trace_close(&tr);
+    hitime_expire_all(&h);
+    while (hitime_get_next(&h)) {}
+    hitime_destroy(&h);
+    free(tos);
+}
+
+/**
+ * @brief Give each distinct key of the trace an index.
+ * @return The index of each record's timeout; NO_INDEX if it has none,
+ *         UNTRACKED if it is taken as expired before it is ever started.
+ */
+static uint32_t *
+map_keys(const hitime_trace_rec_t *recs, size_t len, size_t *count, size_t *untracked)
+{
+    size_t cap = 16;
+    while (cap < 2 * len)
+    {
+        cap <<= 1;
+    }
+    uint64_t *keys = calloc(cap, sizeof(uint64_t));
+    uint32_t *slots = malloc(cap * sizeof(uint32_t));
+    uint32_t *idx = malloc((len + 1) * sizeof(uint32_t));
+    bool *started = calloc(len + 1, sizeof(bool));
+    size_t i;
+
+    *count = 0;
+    *untracked = 0;
+    for (i = 0; i < len; ++i)
+    {
+        uint64_t key = recs[i].key;
+        if (!key)
+        {
+            idx[i] = NO_INDEX;
+            continue;
+        }
+
+        size_t s = (size_t)((key >> 3) * 0x9E3779B97F4A7C15ull) & (cap - 1);
+        while (keys[s] && keys[s] != key)
+        {
+            s = (s + 1) & (cap - 1);
+        }
+        if (!keys[s])
+        {
+            keys[s] = key;
+            slots[s] = (uint32_t)(*count)++;
+        }
+        idx[i] = slots[s];
+
+        switch (recs[i].op)
+        {
+            case HITIME_TRACE_START:
+            case HITIME_TRACE_TOUCH:
+            case HITIME_TRACE_TOUCH_LAZY:
+                started[idx[i]] = true;
+                break;
+            case HITIME_TRACE_NEXT:
+                if (!started[idx[i]])
+                {
+                    idx[i] = UNTRACKED;
+                    ++*untracked;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    free(started);
+    free(keys);
+    free(slots);
+    return idx;
+}
+
+/**
+ * @brief Make the call of the record.
+ * @return False if the expired timeout taken was not the one recorded.
+ */
+static inline bool
+apply(hitime_t *h, hitimeout_t *tos, const hitime_trace_rec_t *r, uint32_t index)
+{
+    hitimeout_t *t = index >= UNTRACKED ? NULL : tos + index;
+    hitime_node_t l;
+
+    switch (r->op)
+    {
+        case HITIME_TRACE_START:
+            t->when = r->time;
+            hitime_start(h, t);
+            break;
+        case HITIME_TRACE_STOP:
+            hitime_stop(h, t);
+            break;
+        case HITIME_TRACE_TOUCH:
+            hitime_touch(h, t, r->time);
+            break;
+        case HITIME_TRACE_TOUCH_LAZY:
+            hitime_touch_lazy(h, t, r->time);
+            break;
+        case HITIME_TRACE_TIMEOUT:
+            hitime_timeout(h, r->time);
+            break;
+        case HITIME_TRACE_PARTIAL:
+            hitime_timeout_partial(h, r->time, (int)r->arg);
+            break;
+        case HITIME_TRACE_EXPIRE_ALL:
+            hitime_expire_all(h);
+            break;
+        case HITIME_TRACE_NEXT:
+            return !t || hitime_get_next(h) == t;
+        case HITIME_TRACE_TAKE:
+            /* The caller took every one off the list. */
+            hitime_take_expired(h, &l);
+            while (hitime_list_next(&l)) {}
+            break;
+        case HITIME_TRACE_BASE:
+            if (r->time > hitime_get_last(h))
+            {
+                hitime_timeout(h, r->time);
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static void
+cleanup(hitime_t *h)
+{
+    hitime_expire_all(h);
+    while (hitime_get_next(h)) {}
+    hitime_destroy(h);
+}
+
+static void
+print_summary(const char *name, const hitime_hist_t *hist)
+{
+    hitime_summary_t s;
+    hitime_hist_summarize(hist, &s);
+    printf("%-11s %10lu %8lu %8lu %8lu %10lu\n", name, s.count, s.p50, s.p99, s.p999, s.max);
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmp[] = "/tmp/hitime_replayXXXXXX";
+    const char *path = argc > 1 ? argv[1] : tmp;
+    size_t len = 0;
+    size_t count = 0;
+    size_t untracked = 0;
+    size_t i;
+
+    if (argc <= 1)
+    {
+        if (!HITIME_TRACE)
+        {
+            fprintf(stderr, "Give a trace, or build with HITIME_TRACE to record one.\n");
+            return 1;
+        }
+        srand(get_seed(FORCESEED));
+        close(mkstemp(tmp));
+        record(tmp);
+    }
+
+    hitime_trace_rec_t *recs = hitime_trace_read(path, &len);
+    if (argc <= 1)
+    {
+        unlink(tmp);
+    }
+    if (!recs)
+    {
+        fprintf(stderr, "Not a trace with %d-bit times: %s\n", HITIME_TIME_BITS, path);
+        return 1;
+    }
+
+    uint32_t *idx = map_keys(recs, len, &count, &untracked);
+    hitimeout_t *tos = calloc(count + 1, sizeof(hitimeout_t));
+    printf("Calls: %zu, timeouts: %zu\n", len, count);
+    printf("Expiries of timeouts started before the trace: %zu\n", untracked);
+
+    /* Throughput. */
+    stopwatch_t sw;
+    hitime_t h;
+    size_t mismatched = 0;
+    for (i = 0; i < count; ++i)
+    {
+        hitimeout_init(tos + i);
+    }
+    hitime_init(&h);
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+    for (i = 0; i < len; ++i)
+    {
+        mismatched += !apply(&h, tos, recs + i, idx[i]);
+    }
+    stopwatch_stop(&sw);
+    cleanup(&h);
+    double seconds = stopwatch_elapsed(&sw);
+    printf("Seconds: %f\n", seconds);
+    printf("Calls/second: %f\n", (double)len / seconds);
+    printf("Mismatched expiries: %zu\n", mismatched);
+
+    /* Latency. */
+    hitime_hist_t hists[HITIME_TRACE_OPS];
+    hitime_hist_t overhead;
+    int op;
+    for (op = 0; op < HITIME_TRACE_OPS; ++op)
+    {
+        hitime_hist_reset(hists + op);
+    }
+    hitime_hist_reset(&overhead);
+    for (i = 0; i < len; ++i)
+    {
+        uint64_t start = stopwatch_now_ns();
+        hitime_hist_record(&overhead, stopwatch_now_ns() - start);
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        hitimeout_init(tos + i);
+    }
+    hitime_init(&h);
+    for (i = 0; i < len; ++i)
+    {
+        if (UNTRACKED == idx[i])
+        {
+            continue;
+        }
+        uint64_t start = stopwatch_now_ns();
+        apply(&h, tos, recs + i, idx[i]);
+        hitime_hist_record(hists + recs[i].op, stopwatch_now_ns() - start);
+    }
+    cleanup(&h);
+
+    printf("%-11s %10s %8s %8s %8s %10s\n", "ns/call", "calls", "p50", "p99", "p999", "max");
+    for (op = 1; op < HITIME_TRACE_OPS; ++op)
+    {
+        if (hists[op].count)
+        {
+            print_summary(hitime_trace_op_name(op), hists + op);
+        }
+    }
+    print_summary("clock", &overhead);
+
+    free(tos);
+    free(idx);
+    free(recs);
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,360 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file scaling.c
+ * @author Craig Jacobson
+ * @brief Many independent managers, one per thread, from one thread to many.
+ *
+ * Every thread has its own manager and timeouts and runs the same workload:
+ * restart a timeout, and now and then close one and open another with
+ * hitimeout_free and hitimeout_new, ticking the time every so often and
+ * restarting what expires. Nothing is shared but the allocator, the memory
+ * bus, and whatever lines the managers share. The managers are laid out as:
+ * - packed: one array of hitime_t, placed so neighbors share a line
+ * - padded: one array of hitime_t, each padded to a pair of lines of its own,
+ *   since the adjacent-line prefetcher fetches lines in pairs
+ * - local: hitime_new called by each thread
+ *
+ * If hitime_t is a whole number of lines the packed array starts half a line
+ * in. With HITIME_STATS the manager is aligned to a line, so it cannot share
+ * one and packed is the same as padded to a line.
+ *
+ * One in SAMPLE_EVERY restarts, and every tick with its expiries, is timed
+ * with cycles.h. Prints CSV: layout, threads, thread, operations, seconds,
+ * operations per second, then p50, p99, p999, and max ns of the restarts
+ * and of the ticks. Each thread has a row, then a row "all" with the total
+ * throughput and the worst of each percentile.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cycles.h"
+#include "hitime.h"
+#include "hitime_hist.h"
+#include "stopwatch.h"
+
+#ifndef MAXTHREADS
+#define MAXTHREADS (0)
+#endif
+
+#ifndef OPS
+#define OPS (1024*1024 * 8)
+#endif
+
+/* Timeouts per thread; large enough that cascades go to memory. */
+#ifndef LOCAL
+#define LOCAL (1024*256)
+#endif
+
+#ifndef TICK_EVERY
+#define TICK_EVERY (1024)
+#endif
+
+#ifndef CHURN_EVERY
+#define CHURN_EVERY (16)
+#endif
+
+#ifndef SAMPLE_EVERY
+#define SAMPLE_EVERY (16)
+#endif
+
+#define LINE (64)
+#define LINE_PAIR (128)
+
+/* Start of the packed array past a line, so the ends of neighbors share one. */
+#define PACKED_OFFSET \
+    (0 == sizeof(hitime_t) % LINE && _Alignof(hitime_t) <= LINE / 2 ? LINE / 2 : 0)
+
+
+enum
+{
+    LAYOUT_PACKED = 0,
+    LAYOUT_PADDED,
+    LAYOUT_LOCAL,
+    LAYOUT_COUNT,
+};
+
+static const char *const layout_names[LAYOUT_COUNT] =
+{
+    "packed", "padded", "local",
+};
+
+typedef struct
+{
+    _Alignas(LINE_PAIR) hitime_t h;
+} padded_t;
+
+typedef struct
+{
+    hitime_t *         h;//NULL to call hitime_new
+    pthread_barrier_t *barrier;
+    int                index;
+    double             seconds;
+    hitime_hist_t      restarts;
+    hitime_hist_t      ticks;
+} worker_t;
+
+static double per_ns;
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static inline hitime_time_t
+ttl(uint64_t *state)
+{
+    return 1 + (xorshift64(state) & 0xFFFF);
+}
+
+static void *
+alloc_lines(size_t size)
+{
+    void *mem = NULL;
+    if (posix_memalign(&mem, LINE_PAIR, size))
+    {
+        abort();
+    }
+    return mem;
+}
+
+static void *
+work(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t state = (uint64_t)w->index * 0x9E3779B97F4A7C15ULL + 1;
+    hitime_t *h = w->h ? w->h : hitime_new();
+    hitimeout_t **tos = malloc(LOCAL * sizeof(hitimeout_t *));
+    uint64_t now = 1;
+    stopwatch_t sw;
+    int i;
+
+    for (i = 0; i < LOCAL; ++i)
+    {
+        tos[i] = hitimeout_new();
+        hitimeout_set(tos[i], now + ttl(&state), NULL);
+        hitime_start(h, tos[i]);
+    }
+
+    pthread_barrier_wait(w->barrier);
+    stopwatch_reset(&sw);
+    stopwatch_start(&sw);
+
+    for (i = 0; i < OPS; ++i)
+    {
+        int index = (int)(xorshift64(&state) % LOCAL);
+        hitimeout_t *t = tos[index];
+
+        if (0 == (i % CHURN_EVERY))
+        {
+            hitime_stop(h, t);
+            hitimeout_free(tos + index);
+            tos[index] = t = hitimeout_new();
+            hitimeout_set(t, now + ttl(&state), NULL);
+            hitime_start(h, t);
+        }
+        else if (1 == (i % SAMPLE_EVERY))
+        {
+            uint64_t start = cycles_start();
+            hitime_touch(h, t, now + ttl(&state));
+            hitime_hist_record(&w->restarts, cycles_stop() - start);
+        }
+        else
+        {
+            hitime_touch(h, t, now + ttl(&state));
+        }
+
+        if (0 == (i % TICK_EVERY))
+        {
+            uint64_t start = cycles_start();
+            ++now;
+            hitime_timeout(h, now);
+            while ((t = hitime_get_next(h)))
+            {
+                t->when = now + ttl(&state);
+                hitime_start(h, t);
+            }
+            hitime_hist_record(&w->ticks, cycles_stop() - start);
+        }
+    }
+
+    stopwatch_stop(&sw);
+    w->seconds = stopwatch_elapsed(&sw);
+    pthread_barrier_wait(w->barrier);
+
+    hitime_expire_all(h);
+    while (hitime_get_next(h)) {}
+    for (i = 0; i < LOCAL; ++i)
+    {
+        hitimeout_free(tos + i);
+    }
+    free(tos);
+    if (!w->h)
+    {
+        hitime_free(&h);
+    }
+
+    return NULL;
+}
+
+static void
+print_row(const char *layout, int threads, const char *thread, double ops, double seconds,
+          const hitime_summary_t *r, const hitime_summary_t *t)
+{
+    printf("%s,%d,%s,%.0f,%f,%f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+           layout, threads, thread, ops, seconds, ops / seconds,
+           (double)r->p50 / per_ns, (double)r->p99 / per_ns,
+           (double)r->p999 / per_ns, (double)r->max / per_ns,
+           (double)t->p50 / per_ns, (double)t->p99 / per_ns,
+           (double)t->p999 / per_ns, (double)t->max / per_ns);
+}
+
+static void
+worst(hitime_summary_t *out, const hitime_summary_t *s)
+{
+    out->count += s->count;
+    out->p50 = s->p50 > out->p50 ? s->p50 : out->p50;
+    out->p99 = s->p99 > out->p99 ? s->p99 : out->p99;
+    out->p999 = s->p999 > out->p999 ? s->p999 : out->p999;
+    out->max = s->max > out->max ? s->max : out->max;
+}
+
+static void
+run(int layout, int threads)
+{
+    stopwatch_t sw;
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    void *raw = NULL;
+    hitime_t *packed = NULL;
+    padded_t *padded = NULL;
+    if (LAYOUT_PACKED == layout)
+    {
+        raw = alloc_lines(threads * sizeof(hitime_t) + PACKED_OFFSET);
+        packed = (hitime_t *)((char *)raw + PACKED_OFFSET);
+    }
+    else if (LAYOUT_PADDED == layout)
+    {
+        padded = alloc_lines(threads * sizeof(padded_t));
+    }
+
+    worker_t *workers = alloc_lines(threads * sizeof(worker_t));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+
+    int i;
+    for (i = 0; i < threads; ++i)
+    {
+        worker_t *w = workers + i;
+        w->h = packed ? packed + i : padded ? &padded[i].h : NULL;
+        if (w->h)
+        {
+            hitime_init(w->h);
+        }
+        w->barrier = &barrier;
+        w->index = i;
+        hitime_hist_reset(&w->restarts);
+        hitime_hist_reset(&w->ticks);
+        pthread_create(ids + i, NULL, work, w);
+    }
+
+    stopwatch_reset(&sw);
+    pthread_barrier_wait(&barrier);
+    stopwatch_start(&sw);
+    pthread_barrier_wait(&barrier);
+    stopwatch_stop(&sw);
+
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(ids[i], NULL);
+    }
+
+    hitime_summary_t all_r = { 0 };
+    hitime_summary_t all_t = { 0 };
+    for (i = 0; i < threads; ++i)
+    {
+        worker_t *w = workers + i;
+        hitime_summary_t r, t;
+        char name[16];
+        hitime_hist_summarize(&w->restarts, &r);
+        hitime_hist_summarize(&w->ticks, &t);
+        snprintf(name, sizeof(name), "%d", i);
+        print_row(layout_names[layout], threads, name, (double)OPS, w->seconds, &r, &t);
+        worst(&all_r, &r);
+        worst(&all_t, &t);
+        if (w->h)
+        {
+            hitime_destroy(w->h);
+        }
+    }
+    print_row(layout_names[layout], threads, "all", (double)threads * (double)OPS,
+              stopwatch_elapsed(&sw), &all_r, &all_t);
+    fflush(stdout);
+
+    free(ids);
+    free(workers);
+    free(raw);
+    free(padded);
+    pthread_barrier_destroy(&barrier);
+}
+
+int
+main(void)
+{
+    int maxthreads = MAXTHREADS;
+    if (!maxthreads)
+    {
+        maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    per_ns = cycles_per_ns(100);
+
+    printf("Manager: %zu octets, packed offset: %d octets, padded: %zu octets, timeout: %zu octets\n",
+           sizeof(hitime_t), (int)PACKED_OFFSET, sizeof(padded_t), sizeof(hitimeout_t));
+    if (_Alignof(hitime_t) >= LINE)
+    {
+        printf("Managers are aligned to a line; packed neighbors cannot share one\n");
+    }
+    printf("layout,threads,thread,ops,seconds,ops_per_sec,"
+           "restart_ns_p50,restart_ns_p99,restart_ns_p999,restart_ns_max,"
+           "tick_ns_p50,tick_ns_p99,tick_ns_p999,tick_ns_max\n");
+
+    int layout;
+    for (layout = 0; layout < LAYOUT_COUNT; ++layout)
+    {
+        int threads;
+        for (threads = 1; threads < maxthreads; threads *= 2)
+        {
+            run(layout, threads);
+        }
+        run(layout, maxthreads);
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file sharded.c
+ * @author Craig Jacobson
+ * @brief Scaling of the sharded manager from one thread to many.
+ *
+ * Every thread owns a shard and restarts its own timeouts; every so often it
+ * posts a start to the next shard, which exercises the queues, and stops every
+ * other one of those from its own shard, which posts the stop to the next.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hitime_sharded.h"
+#include "stopwatch.h"
+
+#ifndef MAXTHREADS
+#define MAXTHREADS (0)
+#endif
+
+#ifndef OPS
+#define OPS (1024*1024 * 8)
+#endif
+
+#ifndef LOCAL
+#define LOCAL (1024*64)
+#endif
+
+#ifndef REMOTE_EVERY
+#define REMOTE_EVERY (64)
+#endif
+
+#ifndef TICK_EVERY
+#define TICK_EVERY (1024)
+#endif
+
+
+typedef struct
+{
+    hitime_sharded_t *    hs;
+    pthread_barrier_t *   barrier;
+    int                   index;
+    hitimeout_sharded_t * local;
+    hitimeout_sharded_t * remote;
+} worker_t;
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void
+drain(hitime_sharded_t *hs, int index)
+{
+    while (hitime_sharded_get_next(hs, index)) {}
+}
+
+static void *
+work(void *arg)
+{
+    worker_t *w = arg;
+    hitime_sharded_t *hs = w->hs;
+    int count = hitime_sharded_count(hs);
+    int next = (w->index + 1) % count;
+    uint64_t state = (uint64_t)w->index * 0x9E3779B97F4A7C15ULL + 1;
+    uint64_t now = 1;
+    int remote = 0;
+
+    hitime_sharded_bind(hs, w->index);
+    pthread_barrier_wait(w->barrier);
+
+    int i;
+    for (i = 0; i < OPS; ++i)
+    {
+        hitimeout_sharded_t *t = w->local + (i % LOCAL);
+        hitime_sharded_stop(hs, t);
+        hitimeout_set(&t->t, now + 1 + (xorshift64(&state) & 0xFFFF), NULL);
+        hitime_sharded_start(hs, t);
+
+        if (0 == (i % REMOTE_EVERY))
+        {
+            t = w->remote + remote++;
+            hitimeout_set(&t->t, now + 1 + (xorshift64(&state) & 0xFFFF), NULL);
+            if (!hitime_sharded_post_start(hs, next, t))
+            {
+                // The neighbor is behind; drop it rather than stall
+                --remote;
+            }
+            else if (remote >= 2 && (remote & 1))
+            {
+                // Cancel an earlier one; the stop goes to the neighbor's queue
+                hitime_sharded_stop(hs, w->remote + remote - 2);
+            }
+        }
+
+        if (0 == (i % TICK_EVERY))
+        {
+            ++now;
+            if (hitime_sharded_timeout(hs, w->index, now))
+            {
+                drain(hs, w->index);
+            }
+        }
+    }
+
+    // Wait for the posts from the neighbor before emptying the shard
+    pthread_barrier_wait(w->barrier);
+    hitime_sharded_timeout(hs, w->index, now + 1);
+    hitime_expire_all(hitime_sharded_get(hs, w->index));
+    drain(hs, w->index);
+    hitime_sharded_bind(hs, -1);
+
+    return NULL;
+}
+
+static void
+run(int threads)
+{
+    stopwatch_t sw;
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    hitime_sharded_t *hs = hitime_sharded_new(threads, HITIME_SHARD_THREAD);
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+
+    int i;
+    for (i = 0; i < threads; ++i)
+    {
+        worker_t *w = workers + i;
+        w->hs = hs;
+        w->barrier = &barrier;
+        w->index = i;
+        w->local = calloc(LOCAL, sizeof(hitimeout_sharded_t));
+        w->remote = calloc(OPS / REMOTE_EVERY + 1, sizeof(hitimeout_sharded_t));
+        pthread_create(ids + i, NULL, work, w);
+    }
+
+    stopwatch_reset(&sw);
+    pthread_barrier_wait(&barrier);
+    stopwatch_start(&sw);
+    pthread_barrier_wait(&barrier);
+    stopwatch_stop(&sw);
+
+    // Timeouts posted to a neighbor belong to it until it is done
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    for (i = 0; i < threads; ++i)
+    {
+        free(workers[i].local);
+        free(workers[i].remote);
+    }
+
+    double seconds = stopwatch_elapsed(&sw);
+    double ops = (double)threads * (double)OPS;
+    printf("Threads: %d, Seconds: %f, Ops/second: %f, Ops/second/thread: %f\n",
+           threads, seconds, ops / seconds, ops / seconds / threads);
+
+    free(ids);
+    free(workers);
+    hitime_sharded_free(&hs);
+    pthread_barrier_destroy(&barrier);
+}
+
+int
+main(void)
+{
+    int maxthreads = MAXTHREADS;
+    if (!maxthreads)
+    {
+        maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    printf("SHARDED SCALING STATS\n");
+    int threads;
+    for (threads = 1; threads < maxthreads; threads *= 2)
+    {
+        run(threads);
+    }
+    run(maxthreads);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright (c) 2021 Craig Jacobson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+/**
+ * @file stopwatch.h
+ * @author Craig Jacobson
+ * @brief Timing and random helpers shared by the benchmarks.
+ */
+#ifndef STOPWATCH_H_
+#define STOPWATCH_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef struct
+{
+    struct timespec start;
+    struct timespec end;
+} stopwatch_t;
+
+static inline void
+stopwatch_reset(stopwatch_t *sw)
+{
+    sw->start = (struct timespec){ 0 };
+    sw->end = (struct timespec){ 0 };
+}
+
+static inline void
+stopwatch_start(stopwatch_t *sw)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, &sw->start))
+    {
+        printf("Error getting start time: %d, %s\n", errno, strerror(errno));
+        abort();
+    }
+}
+
+static inline void
+stopwatch_stop(stopwatch_t *sw)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, &sw->end))
+    {
+        printf("Error getting end time: %d, %s\n", errno, strerror(errno));
+        abort();
+    }
+}
+
+/**
+ * @return Monotonic nanoseconds, for timing single calls.
+ */
+static inline uint64_t
+stopwatch_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline double
+stopwatch_elapsed(stopwatch_t *sw)
+{
+    double seconds =
+        (double)(sw->end.tv_sec - sw->start.tv_sec)
+        + ((double)sw->end.tv_nsec - (double)sw->start.tv_nsec)/1000000000.0;
+    return seconds;
+}
+
+static inline uint64_t
+rand64(void)
+{
+    uint32_t arr[2];
+    arr[0] = (uint32_t)random();
+    arr[1] = (uint32_t)random();
+    return ((uint64_t)arr[0] << 32) ^ (uint64_t)arr[1];
+}
+
+static inline int
+get_seed(int seed)
+{
+    if (!seed)
+    {
+        seed = (int)time(0);
+    }
+
+    printf("Seed: %d\n", seed);
+    return seed;
+}
+
+#endif /* STOPWATCH_H_ */